@@ -458,57 +458,83 @@ public:
     LiveOut = 3,
   };
 
-  /// A bit vector that stores information about liveness. This is composed
-  /// with SmallBitVector since it contains two bits per liveness so that it
-  /// can represent 3 states, Dead, LiveWithin, LiveOut. We take advantage of
-  /// their numeric values to make testing easier \see documentation on IsLive.
+  /// A bit vector that stores information about liveness. Two bits are packed
+  /// per tracked field directly into 64 bit words (so 32 fields per word),
+  /// making a single state read or write one shift-and-mask rather than two
+  /// separate bit vector accesses. The 2 bit encoding takes advantage of the
+  /// numeric values of IsLive: a field is Dead if the first bit is 0 and
+  /// LiveOut if the second bit is set. \see documentation on IsLive.
   class LivenessSmallBitVector {
-    SmallBitVector bits;
+    /// The packed liveness states, 2 bits per tracked field.
+    SmallVector<uint64_t, 1> words;
+
+    /// The number of tracked fields.
+    unsigned numBits = 0;
 
   public:
-    LivenessSmallBitVector() : bits() {}
+    LivenessSmallBitVector() {}
 
-    void init(unsigned numBits) {
-      assert(bits.size() == 0);
-      assert(numBits != 0);
-      bits.resize(numBits * 2);
+    void init(unsigned numBitsToTrack) {
+      assert(numBits == 0);
+      assert(numBitsToTrack != 0);
+      numBits = numBitsToTrack;
+      words.assign((numBits + 31) / 32, 0);
     }
 
-    unsigned size() const { return bits.size() / 2; }
+    unsigned size() const { return numBits; }
 
     IsLive getLiveness(unsigned bitNo) const {
-      if (!bits[bitNo * 2])
-        return IsLive::Dead;
-      return bits[bitNo * 2 + 1] ? LiveOut : LiveWithin;
+      assert(bitNo < numBits);
+      return IsLive((words[bitNo / 32] >> ((bitNo % 32) * 2)) & 3);
     }
 
     /// Returns the liveness in \p resultingFoundLiveness. We only return the
     /// bits for endBitNo - startBitNo.
     void getLiveness(unsigned startBitNo, unsigned endBitNo,
                      SmallVectorImpl<IsLive> &resultingFoundLiveness) const {
-      unsigned actualStartBitNo = startBitNo * 2;
-      unsigned actualEndBitNo = endBitNo * 2;
-
-      for (unsigned i = actualStartBitNo, e = actualEndBitNo; i != e; i += 2) {
-        if (!bits[i]) {
-          resultingFoundLiveness.push_back(Dead);
-          continue;
-        }
-
-        resultingFoundLiveness.push_back(bits[i + 1] ? LiveOut : LiveWithin);
+      assert(endBitNo <= numBits);
+      // Load each word once and shift the packed states out of it.
+      for (unsigned i = startBitNo; i != endBitNo;) {
+        uint64_t word = words[i / 32] >> ((i % 32) * 2);
+        unsigned wordEnd = std::min(endBitNo, (i / 32 + 1) * 32);
+        for (; i != wordEnd; ++i, word >>= 2)
+          resultingFoundLiveness.push_back(IsLive(word & 3));
       }
     }
 
     void setLiveness(unsigned startBitNo, unsigned endBitNo, IsLive isLive) {
-      for (unsigned i = startBitNo * 2, e = endBitNo * 2; i != e; i += 2) {
-        bits[i] = isLive & 1;
-        bits[i + 1] = isLive & 2;
+      assert(endBitNo <= numBits);
+      for (unsigned i = startBitNo; i != endBitNo; ++i) {
+        unsigned shift = (i % 32) * 2;
+        uint64_t &word = words[i / 32];
+        word = (word & ~(uint64_t(3) << shift)) | (uint64_t(isLive) << shift);
       }
     }
 
     void setLiveness(unsigned bitNo, IsLive isLive) {
       setLiveness(bitNo, bitNo + 1, isLive);
     }
+
+    /// Decompose the packed states into separate live-within and live-out
+    /// masks, setting bits into the passed in vectors. Dead fields are skipped
+    /// a whole word (32 fields) at a time.
+    void getLiveness(SmallBitVector &liveWithinBits,
+                     SmallBitVector &liveOutBits) const {
+      for (unsigned i = 0, e = words.size(); i != e; ++i) {
+        uint64_t word = words[i];
+        if (!word)
+          continue;
+        unsigned wordEnd = std::min(numBits, (i + 1) * 32);
+        for (unsigned bitNo = i * 32; bitNo != wordEnd; ++bitNo, word >>= 2) {
+          if (!(word & 1))
+            continue;
+          if (word & 2)
+            liveOutBits.set(bitNo);
+          else
+            liveWithinBits.set(bitNo);
+        }
+      }
+    }
   };
 
 private:
@@ -625,43 +651,58 @@ public:
     liveBlockIter->second.getLiveness(startBitNo, endBitNo, foundLivenessInfo);
   }
 
+  /// Set the live-within and live-out bits of \p bb into the passed in
+  /// vectors. Callers must pass in cleared vectors sized to the number of
+  /// tracked bits; bits that remain unset in both vectors are dead.
+  void getBlockLiveness(SILBasicBlock *bb, SmallBitVector &liveWithinBits,
+                        SmallBitVector &liveOutBits) const {
+    assert(isInitialized());
+    assert(liveWithinBits.none() && liveOutBits.none());
+    auto liveBlockIter = liveBlocks.find(bb);
+    if (liveBlockIter == liveBlocks.end())
+      return;
+    liveBlockIter->second.getLiveness(liveWithinBits, liveOutBits);
+  }
+
   llvm::StringRef getStringRef(IsLive isLive) const;
   void print(llvm::raw_ostream &OS) const;
   void dump() const;
 
 protected:
-  void markBlockLive(SILBasicBlock *bb, unsigned bitNo, IsLive isLive) {
+  /// Return \p bb's liveness state, creating an all-Dead entry (and reporting
+  /// the block as discovered) the first time \p bb is seen. The returned
+  /// reference is invalidated by any later insertion into the map.
+  LivenessSmallBitVector &getOrCreateBlockLiveness(SILBasicBlock *bb) {
     assert(isInitialized());
-
-    assert(isLive != Dead && "erasing live blocks isn't implemented.");
     auto iterAndInserted =
         liveBlocks.insert(std::make_pair(bb, LivenessSmallBitVector()));
     if (iterAndInserted.second) {
       // We initialize the size of the small bit vector here rather than in
       // liveBlocks.insert above to prevent us from allocating upon failure if
       // we have more than SmallBitVector's small size number of bits.
-      auto &insertedBV = iterAndInserted.first->getSecond();
-      insertedBV.init(*numBitsToTrack);
-      insertedBV.setLiveness(bitNo, bitNo + 1, isLive);
+      iterAndInserted.first->getSecond().init(*numBitsToTrack);
       if (discoveredBlocks)
         discoveredBlocks->push_back(bb);
-    } else {
-      // If we are dead, always update to the new liveness.
-      switch (iterAndInserted.first->getSecond().getLiveness(bitNo)) {
-      case Dead:
-        iterAndInserted.first->getSecond().setLiveness(bitNo, bitNo + 1,
-                                                       isLive);
-        break;
-      case LiveWithin:
-        if (isLive == LiveOut) {
-          // Update the existing entry to be live-out.
-          iterAndInserted.first->getSecond().setLiveness(bitNo, bitNo + 1,
-                                                         LiveOut);
-        }
-        break;
-      case LiveOut:
-        break;
+    }
+    return iterAndInserted.first->getSecond();
+  }
+
+  void markBlockLive(SILBasicBlock *bb, unsigned bitNo, IsLive isLive) {
+    assert(isLive != Dead && "erasing live blocks isn't implemented.");
+    auto &liveness = getOrCreateBlockLiveness(bb);
+    // If we are dead, always update to the new liveness.
+    switch (liveness.getLiveness(bitNo)) {
+    case Dead:
+      liveness.setLiveness(bitNo, bitNo + 1, isLive);
+      break;
+    case LiveWithin:
+      if (isLive == LiveOut) {
+        // Update the existing entry to be live-out.
+        liveness.setLiveness(bitNo, bitNo + 1, LiveOut);
       }
+      break;
+    case LiveOut:
+      break;
     }
   }
 
@@ -814,6 +855,37 @@ private:
   /// The root address of our type tree.
   SILValue rootValue;
 
+  /// Cached copy of the number of bits tracked by liveBlocks, so the hot
+  /// update paths size their scratch vectors from a plain field instead of
+  /// unwrapping liveBlocks' optional bit count on every call.
+  unsigned numSubElements = 0;
+
+  /// Scratch buffer that updateForUse/extendToNonUse hand to the block
+  /// liveness computation, kept as a member so its storage is reused across
+  /// the many updates performed while computing a live range.
+  SmallVector<FieldSensitivePrunedLiveBlocks::IsLive, 16> livenessScratch;
+
+  /// Union, per block, of the bits at which some instruction in the block has
+  /// been recorded as a lifetime ending user. Conservative: a bit stays set
+  /// even if its user is later downgraded to non-lifetime-ending, so this may
+  /// only be used to skip blocks that certainly contain no consuming use.
+  llvm::SmallDenseMap<SILBasicBlock *, SmallBitVector, 4> consumingBlockBits;
+
+  SmallBitVector &getOrCreateConsumingBlockBits(SILBasicBlock *block) {
+    auto &bits = consumingBlockBits[block];
+    if (bits.size() != getNumSubElements())
+      bits.resize(getNumSubElements());
+    return bits;
+  }
+
+  /// Shared implementation of updateForUse/extendToNonUse that drives the
+  /// block liveness dataflow for \p range, resp. each contiguous run of set
+  /// bits in \p bits.
+  void updateBlockLiveness(SILInstruction *user, TypeTreeLeafTypeRange range,
+                           SmallBitVector const &useBeforeDefBits);
+  void updateBlockLiveness(SILInstruction *user, SmallBitVector const &bits,
+                           SmallBitVector const &useBeforeDefBits);
+
 public:
   FieldSensitivePrunedLiveness(
       SILFunction *fn,
@@ -828,13 +900,16 @@ public:
   void clear() {
     liveBlocks.clear();
     users.clear();
+    consumingBlockBits.clear();
     rootValue = SILValue();
+    numSubElements = 0;
   }
 
   void init(SILValue newRootValue) {
     clear();
     rootValue = newRootValue;
-    liveBlocks.init(TypeSubElementCount(newRootValue));
+    numSubElements = TypeSubElementCount(newRootValue);
+    liveBlocks.init(numSubElements);
   }
 
   bool isInitialized() const {
@@ -961,6 +1036,31 @@ public:
     return &iter->second;
   }
 
+  /// Set into \p bits every bit at which \p user is an interesting user of any
+  /// kind. This performs a single map lookup, so callers that test many bits
+  /// of the same instruction should prefer it over repeated calls to
+  /// isInterestingUser.
+  void getInterestingUserBits(SILInstruction *user,
+                              SmallBitVector &bits) const {
+    assert(isInitialized());
+    if (auto *record = getInterestingUser(user)) {
+      bits |= record->liveBits;
+      bits |= record->consumingBits;
+    }
+  }
+
+  /// Return a conservative union of the bits at which \p block contains a
+  /// lifetime ending user, or nullptr if no such user was ever recorded in
+  /// the block. Bits may be stale-positive (\see consumingBlockBits), so a
+  /// set bit demands a precise per-instruction scan while an unset bit proves
+  /// the block contains no consuming use at that bit.
+  SmallBitVector const *getConsumingBlockBits(SILBasicBlock *block) const {
+    auto iter = consumingBlockBits.find(block);
+    if (iter == consumingBlockBits.end())
+      return nullptr;
+    return &iter->second;
+  }
+
   /// How \p user uses the field at \p element.
   IsInterestingUser isInterestingUser(SILInstruction *user,
                                       unsigned element) const {
@@ -986,7 +1086,10 @@ public:
     return true;
   }
 
-  unsigned getNumSubElements() const { return liveBlocks.getNumBitsToTrack(); }
+  unsigned getNumSubElements() const {
+    assert(isInitialized());
+    return numSubElements;
+  }
 
   void print(llvm::raw_ostream &os) const;
   SWIFT_DEBUG_DUMP { print(llvm::dbgs()); }
@@ -1010,11 +1113,15 @@ protected:
   void addInterestingUser(SILInstruction *user, TypeTreeLeafTypeRange range,
                           bool lifetimeEnding) {
     getOrCreateInterestingUser(user).addUses(range, lifetimeEnding);
+    if (lifetimeEnding)
+      range.setBits(getOrCreateConsumingBlockBits(user->getParent()));
   }
 
   void addInterestingUser(SILInstruction *user, SmallBitVector const &bits,
                           bool lifetimeEnding) {
     getOrCreateInterestingUser(user).addUses(bits, lifetimeEnding);
+    if (lifetimeEnding)
+      getOrCreateConsumingBlockBits(user->getParent()) |= bits;
   }
 
   void extendToNonUse(SILInstruction *user, TypeTreeLeafTypeRange range) {
@@ -1120,6 +1227,11 @@ class FieldSensitivePrunedLiveRange : public FieldSensitivePrunedLiveness {
     return reinterpret_cast<const LivenessWithDefs &>(*this);
   }
 
+  /// Scratch bitvector reused by updateForUse/extendToNonUse to collect the
+  /// bits for which \p user occurs before the def, avoiding a heap allocation
+  /// per update when tracking many elements.
+  SmallBitVector useBeforeDefScratch;
+
 public:
   FieldSensitivePrunedLiveRange(
       SILFunction *fn,
@@ -1244,9 +1356,21 @@ public:
     assert(useBeforeDefBits.none());
   }
 
+  void isUserBeforeDef(SILInstruction *user, SmallBitVector const &queryBits,
+                       SmallBitVector &useBeforeDefBits) const {
+    assert(useBeforeDefBits.none());
+  }
+
   void
   findBoundariesInBlock(SILBasicBlock *block, unsigned bitNo, bool isLiveOut,
                         FieldSensitivePrunedLivenessBoundary &boundary) const;
+
+  /// Find the boundary for every bit in \p activeBits at once. \p liveOutBits
+  /// must contain the subset of \p activeBits that are live-out of \p block.
+  void
+  findBoundariesInBlock(SILBasicBlock *block, SmallBitVector const &activeBits,
+                        SmallBitVector const &liveOutBits,
+                        FieldSensitivePrunedLivenessBoundary &boundary) const;
 };
 
 /// MultiDefPrunedLiveness is computed incrementally by calling updateForUse.
@@ -1263,6 +1387,16 @@ class FieldSensitiveMultiDefPrunedLiveRange
   SmallFrozenMultiMap<SILNode *, TypeTreeLeafTypeRange, 8> defs;
   SmallFrozenMultiMap<SILBasicBlock *, TypeTreeLeafTypeRange, 8> defBlocks;
 
+  /// The union of all def bits within each def block, built when the defs are
+  /// frozen. Lets block scans decide with a single probe whether any def is
+  /// relevant instead of walking defBlocks' ranges per queried bit.
+  llvm::SmallDenseMap<SILBasicBlock *, SmallBitVector, 4> defBlockBits;
+
+  /// Each def's ranges collapsed into a single mask, built when the defs are
+  /// frozen. Turns per-(def, bit) queries into one probe and a bit test
+  /// instead of a scan over the def's stored ranges.
+  llvm::SmallDenseMap<SILNode *, SmallBitVector, 8> defNodeBits;
+
 public:
   FieldSensitiveMultiDefPrunedLiveRange(
       SILFunction *fn, SILValue rootValue,
@@ -1287,6 +1421,18 @@ public:
     assert(isInitialized());
     defs.setFrozen();
     defBlocks.setFrozen();
+    for (auto keyValue : defBlocks.getRange()) {
+      auto &bits = defBlockBits[keyValue.first];
+      bits.resize(getNumSubElements());
+      for (auto range : keyValue.second)
+        range.setBits(bits);
+    }
+    for (auto keyValue : defs.getRange()) {
+      auto &bits = defNodeBits[keyValue.first];
+      bits.resize(getNumSubElements());
+      for (auto range : keyValue.second)
+        range.setBits(bits);
+    }
   }
 
   void initializeDef(SILInstruction *def, SmallBitVector const &bits) {
@@ -1312,6 +1458,16 @@ public:
 
   bool isInitialized() const { return Super::isInitialized() && !defs.empty(); }
 
+  /// Return the union of all def bits within \p block, or nullptr if the
+  /// block contains no defs. Only valid once the defs have been frozen.
+  SmallBitVector const *getDefBlockBits(SILBasicBlock *block) const {
+    assert(isInitialized());
+    auto iter = defBlockBits.find(block);
+    if (iter == defBlockBits.end())
+      return nullptr;
+    return &iter->second;
+  }
+
   /// Return true if this block is a def block for this specific bit.
   bool isDefBlock(SILBasicBlock *block, unsigned bit) const {
     assert(isInitialized());
@@ -1352,56 +1508,61 @@ public:
   /// If 'bb' has no users, it is neither a Gen nor Kill. Otherwise, Gen and
   /// Kill are complements.
   bool isUserBeforeDef(SILInstruction *user, unsigned element) const;
+
+  /// Set into \p useBeforeDefBits each queried bit for which \p user occurs
+  /// before the first def in its block. Walks the block once, testing whole
+  /// def masks rather than performing one map lookup per (instruction, bit)
+  /// pair.
+  void isUserBeforeDef(SILInstruction *user, SmallBitVector const &queryBits,
+                       SmallBitVector &useBeforeDefBits) const;
+
   template <typename Iterable>
   void isUserBeforeDef(SILInstruction *user, Iterable const &iterable,
                        SmallBitVector &useBeforeDefBits) const {
-    for (auto bit : iterable) {
-      if (isUserBeforeDef(user, bit)) {
-        useBeforeDefBits.set(bit);
-      }
-    }
+    SmallBitVector queryBits(getNumSubElements());
+    for (auto bit : iterable)
+      queryBits.set(bit);
+    isUserBeforeDef(user, queryBits, useBeforeDefBits);
   }
 
-  bool isDef(SILInstruction *inst, unsigned bit) const {
+  /// Set into \p bits every bit at which \p node is a def, using a single map
+  /// lookup. Callers that test many bits of the same def should prefer this
+  /// over repeated calls to isDef. Only valid once the defs have been frozen.
+  void getDefBits(SILNode *node, SmallBitVector &bits) const {
     assert(isInitialized());
-    auto iter = defs.find(cast<SILNode>(inst));
-    if (!iter)
-      return false;
-    return llvm::any_of(
-        *iter, [&](TypeTreeLeafTypeRange span) { return span.contains(bit); });
+    auto iter = defNodeBits.find(node);
+    if (iter != defNodeBits.end())
+      bits |= iter->second;
   }
 
-  bool isDef(SILValue value, unsigned bit) const {
+  bool isDef(SILNode *node, unsigned bit) const {
     assert(isInitialized());
-    auto iter = defs.find(cast<SILNode>(value));
-    if (!iter)
-      return false;
-    return llvm::any_of(
-        *iter, [&](TypeTreeLeafTypeRange span) { return span.contains(bit); });
+    auto iter = defNodeBits.find(node);
+    return iter != defNodeBits.end() && iter->second.test(bit);
+  }
+
+  bool isDef(SILInstruction *inst, unsigned bit) const {
+    return isDef(cast<SILNode>(inst), bit);
+  }
+
+  bool isDef(SILValue value, unsigned bit) const {
+    return isDef(cast<SILNode>(value), bit);
   }
 
   bool isDef(SILValue value, SmallBitVector const &bits) const {
     assert(isInitialized());
-    auto iter = defs.find(cast<SILNode>(value));
-    if (!iter)
+    auto iter = defNodeBits.find(cast<SILNode>(value));
+    if (iter == defNodeBits.end())
       return false;
-    SmallBitVector allBits(bits.size());
-    for (auto range : *iter) {
-      range.setBits(allBits);
-    }
-    return (bits & allBits) == bits;
+    return (bits & iter->second) == bits;
   }
 
   bool isDef(SILInstruction *inst, SmallBitVector const &bits) const {
     assert(isInitialized());
-    auto iter = defs.find(cast<SILNode>(inst));
-    if (!iter)
+    auto iter = defNodeBits.find(cast<SILNode>(inst));
+    if (iter == defNodeBits.end())
       return false;
-    SmallBitVector allBits(bits.size());
-    for (auto range : *iter) {
-      range.setBits(allBits);
-    }
-    return (bits & allBits) == bits;
+    return (bits & iter->second) == bits;
   }
 
   bool isDef(SILInstruction *inst, TypeTreeLeafTypeRange span) const {
@@ -1424,8 +1585,13 @@ public:
     });
   }
 
+  /// Find the boundary for every bit in \p activeBits with a single reverse
+  /// sweep over \p block, updating the per-bit live state with whole-mask
+  /// bitvector operations. \p liveOutBits must contain the subset of
+  /// \p activeBits that are live-out of \p block.
   void
-  findBoundariesInBlock(SILBasicBlock *block, unsigned bitNo, bool isLiveOut,
+  findBoundariesInBlock(SILBasicBlock *block, SmallBitVector const &activeBits,
+                        SmallBitVector const &liveOutBits,
                         FieldSensitivePrunedLivenessBoundary &boundary) const;
 
   /// Walk from \p inst until we find a def for \p index. If we see a consuming
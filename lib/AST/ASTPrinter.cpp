@@ -964,6 +964,9 @@ private:
   /// \returns true if anything was printed.
   bool printASTNodes(const ArrayRef<ASTNode> &Elements, bool NeedIndent = true);
 
+  /// Print the given declaration along with its auxiliary declarations.
+  void printDeclWithAuxiliaryDecls(Decl *decl);
+
   void printOneParameter(const ParamDecl *param, ParameterTypeFlags paramFlags,
                          bool ArgNameIsAPIByDefault);
 
@@ -2889,28 +2892,25 @@ static bool usesFeatureMacros(Decl *decl) {
   return isa<MacroDecl>(decl);
 }
 
-static bool usesFeatureFreestandingMacros(Decl *decl) {
+/// Whether the given declaration is a macro with any of the given roles.
+static bool usesMacroRoles(Decl *decl, MacroRoles roles) {
   auto macro = dyn_cast<MacroDecl>(decl);
   if (!macro)
     return false;
 
-  return macro->getMacroRoles().contains(MacroRole::Declaration);
+  return static_cast<bool>(macro->getMacroRoles() & roles);
 }
 
-static bool usesFeatureCodeItemMacros(Decl *decl) {
-  auto macro = dyn_cast<MacroDecl>(decl);
-  if (!macro)
-    return false;
+static bool usesFeatureFreestandingMacros(Decl *decl) {
+  return usesMacroRoles(decl, MacroRole::Declaration);
+}
 
-  return macro->getMacroRoles().contains(MacroRole::CodeItem);
+static bool usesFeatureCodeItemMacros(Decl *decl) {
+  return usesMacroRoles(decl, MacroRole::CodeItem);
 }
 
 static bool usesFeatureExtensionMacros(Decl *decl) {
-  auto macro = dyn_cast<MacroDecl>(decl);
-  if (!macro)
-    return false;
-
-  return macro->getMacroRoles().contains(MacroRole::Extension);
+  return usesMacroRoles(decl, MacroRole::Extension);
 }
 
 static bool usesFeatureExtensionMacroAttr(Decl *decl) {
@@ -2926,11 +2926,9 @@ static void suppressingFeatureExtensionMacroAttr(PrintOptions &options,
 }
 
 static bool usesFeatureAttachedMacros(Decl *decl) {
-  auto macro = dyn_cast<MacroDecl>(decl);
-  if (!macro)
-    return false;
-
-  return static_cast<bool>(macro->getMacroRoles() & getAttachedMacroRoles());
+  // The attached role set is a constant; don't re-query it per decl.
+  static const MacroRoles attachedMacroRoles = getAttachedMacroRoles();
+  return usesMacroRoles(decl, attachedMacroRoles);
 }
 
 static bool usesFeatureConcurrentFunctions(Decl *decl) {
@@ -2963,81 +2961,84 @@ static bool usesFeatureSendable(Decl *decl) {
   return false;
 }
 
-static bool usesFeatureRethrowsProtocol(
-    Decl *decl, SmallPtrSet<Decl *, 16> &checked) {
-  // Make sure we don't recurse.
-  if (!checked.insert(decl).second)
-    return false;
+static bool usesFeatureRethrowsProtocol(Decl *decl) {
+  // Fast path: a declaration that is not itself a type or extension, has
+  // no interface type, and is not in a generic context cannot reach any
+  // protocol declaration, so don't bother setting up the walk.
+  if (!isa<NominalTypeDecl>(decl) && !isa<ExtensionDecl>(decl)) {
+    auto value = dyn_cast<ValueDecl>(decl);
+    if ((!value || !value->getInterfaceType()) &&
+        !decl->getInnermostDeclContext()->getGenericSignatureOfContext())
+      return false;
+  }
+
+  SmallPtrSet<Decl *, 16> didVisit;
+  SmallVector<Decl *, 32> toVisit;
+
+  // The visited set already guarantees that each declaration is enqueued
+  // at most once, so the worklist itself only needs push/pop semantics.
+  auto pushDecl = [&](Decl *next) {
+    if (didVisit.insert(next).second)
+      toVisit.push_back(next);
+  };
+  pushDecl(decl);
 
-  // Check an inheritance clause for a marker protocol.
-  auto checkInherited = [&](InheritedTypes inherited) -> bool {
+  // Gather the protocols named by an inheritance clause.
+  auto visitInherited = [&](InheritedTypes inherited) {
     for (unsigned i : inherited.getIndices()) {
       if (auto inheritedType = inherited.getResolvedType(i)) {
         if (inheritedType->isExistentialType()) {
           auto layout = inheritedType->getExistentialLayout();
-          for (ProtocolDecl *proto : layout.getProtocols()) {
-            if (usesFeatureRethrowsProtocol(proto, checked))
-              return true;
-          }
+          for (ProtocolDecl *proto : layout.getProtocols())
+            pushDecl(proto);
         }
       }
     }
-
-    return false;
   };
 
-  if (auto nominal = dyn_cast<NominalTypeDecl>(decl)) {
-    if (checkInherited(nominal->getInherited()))
-      return true;
-  }
+  // Walk the set of type declarations referenced by this declaration,
+  // visiting each of them exactly once.
+  while (!toVisit.empty()) {
+    Decl *next = toVisit.pop_back_val();
 
-  if (auto proto = dyn_cast<ProtocolDecl>(decl)) {
-    if (proto->getAttrs().hasAttribute<AtRethrowsAttr>())
-      return true;
-  }
-
-  if (auto ext = dyn_cast<ExtensionDecl>(decl)) {
-    if (auto nominal = ext->getSelfNominalTypeDecl())
-      if (usesFeatureRethrowsProtocol(nominal, checked))
+    if (auto proto = dyn_cast<ProtocolDecl>(next)) {
+      if (proto->getAttrs().hasAttribute<AtRethrowsAttr>())
         return true;
+    }
 
-    if (checkInherited(ext->getInherited()))
-      return true;
-  }
+    if (auto nominal = dyn_cast<NominalTypeDecl>(next))
+      visitInherited(nominal->getInherited());
 
-  if (auto genericSig = decl->getInnermostDeclContext()
-          ->getGenericSignatureOfContext()) {
-    for (const auto &req : genericSig.getRequirements()) {
-      if (req.getKind() == RequirementKind::Conformance &&
-          usesFeatureRethrowsProtocol(req.getProtocolDecl(), checked))
-        return true;
+    if (auto ext = dyn_cast<ExtensionDecl>(next)) {
+      if (auto nominal = ext->getSelfNominalTypeDecl())
+        pushDecl(nominal);
+
+      visitInherited(ext->getInherited());
     }
-  }
 
-  if (auto value = dyn_cast<ValueDecl>(decl)) {
-    if (Type type = value->getInterfaceType()) {
-      bool hasRethrowsProtocol = type.findIf([&](Type type) {
-        if (auto nominal = type->getAnyNominal()) {
-          if (usesFeatureRethrowsProtocol(nominal, checked))
-            return true;
-        }
+    if (auto genericSig = next->getInnermostDeclContext()
+            ->getGenericSignatureOfContext()) {
+      for (const auto &req : genericSig.getRequirements()) {
+        if (req.getKind() == RequirementKind::Conformance)
+          pushDecl(req.getProtocolDecl());
+      }
+    }
 
-        return false;
-      });
+    if (auto value = dyn_cast<ValueDecl>(next)) {
+      if (Type type = value->getInterfaceType()) {
+        type.findIf([&](Type type) {
+          if (auto nominal = type->getAnyNominal())
+            pushDecl(nominal);
 
-      if (hasRethrowsProtocol)
-        return true;
+          return false;
+        });
+      }
     }
   }
 
   return false;
 }
 
-static bool usesFeatureRethrowsProtocol(Decl *decl) {
-  SmallPtrSet<Decl *, 16> checked;
-  return usesFeatureRethrowsProtocol(decl, checked);
-}
-
 static bool usesFeatureGlobalActors(Decl *decl) {
   return false;
 }
@@ -3150,10 +3151,13 @@ static void suppressingFeatureSpecializeAttributeWithAvailability(
   action();
 }
 
-static bool usesFeatureInheritActorContext(Decl *decl) {
+/// Whether any parameter of the given function declaration has an
+/// attribute of the given kind.
+template <typename AttrType>
+static bool anyParameterHasAttribute(Decl *decl) {
   if (auto func = dyn_cast<AbstractFunctionDecl>(decl)) {
     for (auto param : *func->getParameters()) {
-      if (param->getAttrs().hasAttribute<InheritActorContextAttr>())
+      if (param->getAttrs().hasAttribute<AttrType>())
         return true;
     }
   }
@@ -3161,15 +3165,12 @@ static bool usesFeatureInheritActorContext(Decl *decl) {
   return false;
 }
 
-static bool usesFeatureImplicitSelfCapture(Decl *decl) {
-  if (auto func = dyn_cast<AbstractFunctionDecl>(decl)) {
-    for (auto param : *func->getParameters()) {
-      if (param->getAttrs().hasAttribute<ImplicitSelfCaptureAttr>())
-        return true;
-    }
-  }
+static bool usesFeatureInheritActorContext(Decl *decl) {
+  return anyParameterHasAttribute<InheritActorContextAttr>(decl);
+}
 
-  return false;
+static bool usesFeatureImplicitSelfCapture(Decl *decl) {
+  return anyParameterHasAttribute<ImplicitSelfCaptureAttr>(decl);
 }
 
 static bool usesFeatureBuiltinStackAlloc(Decl *decl) {
@@ -3202,7 +3203,7 @@ static void suppressingFeatureUnsafeInheritExecutor(PrintOptions &options,
 
 static bool usesFeaturePrimaryAssociatedTypes2(Decl *decl) {
   if (auto *protoDecl = dyn_cast<ProtocolDecl>(decl)) {
-    if (protoDecl->getPrimaryAssociatedTypes().size() > 0)
+    if (!protoDecl->getPrimaryAssociatedTypes().empty())
       return true;
   }
 
@@ -3289,14 +3290,16 @@ static bool usesFeatureTupleConformances(Decl *decl) {
 }
 
 static bool usesFeatureSymbolLinkageMarkers(Decl *decl) {
-  auto &attrs = decl->getAttrs();
-  return std::any_of(attrs.begin(), attrs.end(), [](auto *attr) {
-    if (isa<UsedAttr>(attr))
-      return true;
-    if (isa<SectionAttr>(attr))
+  for (auto *attr : decl->getAttrs()) {
+    switch (attr->getKind()) {
+    case DAK_Used:
+    case DAK_Section:
       return true;
-    return false;
-  });
+    default:
+      break;
+    }
+  }
+  return false;
 }
 
 static bool usesFeatureLayoutPrespecialization(Decl *decl) {
@@ -3329,6 +3332,29 @@ static bool usesFeatureFlowSensitiveConcurrencyCaptures(Decl *decl) {
   return false;
 }
 
+/// Like Type::findIf, but visits each (possibly shared) type position at
+/// most once, skipping the children of types that were already seen.
+static bool findIfWithoutRevisiting(Type type,
+                                    llvm::function_ref<bool(Type)> pred) {
+  class Walker : public TypeWalker {
+    llvm::function_ref<bool(Type)> Pred;
+    SmallPtrSet<TypeBase *, 16> Visited;
+
+  public:
+    explicit Walker(llvm::function_ref<bool(Type)> pred) : Pred(pred) {}
+
+    Action walkToTypePre(Type ty) override {
+      if (!Visited.insert(ty.getPointer()).second)
+        return Action::SkipChildren;
+
+      return Pred(ty) ? Action::Stop : Action::Continue;
+    }
+  };
+
+  Walker walker(pred);
+  return type.walk(walker);
+}
+
 static bool usesFeatureMoveOnly(Decl *decl) {
   if (auto *extension = dyn_cast<ExtensionDecl>(decl)) {
     if (auto *nominal = extension->getSelfNominalTypeDecl())
@@ -3344,7 +3370,7 @@ static bool usesFeatureMoveOnly(Decl *decl) {
   if (auto value = dyn_cast<ValueDecl>(decl)) {
     // Check for move-only types in the types of this declaration.
     if (Type type = value->getInterfaceType()) {
-      bool hasMoveOnly = type.findIf([](Type type) {
+      bool hasMoveOnly = findIfWithoutRevisiting(type, [](Type type) {
         return type->isNoncopyable();
       });
 
@@ -3359,7 +3385,8 @@ static bool usesFeatureMoveOnly(Decl *decl) {
 static bool usesFeatureLazyImmediate(Decl *D) { return false; }
 
 static bool usesFeatureMoveOnlyClasses(Decl *decl) {
-  return isa<ClassDecl>(decl) && usesFeatureMoveOnly(decl);
+  auto *classDecl = dyn_cast<ClassDecl>(decl);
+  return classDecl && classDecl->canBeNoncopyable();
 }
 
 static bool usesFeatureMoveOnlyTuples(Decl *decl) {
@@ -3376,14 +3403,14 @@ static bool usesFeatureOldOwnershipOperatorSpellings(Decl *decl) {
 
 static bool usesFeatureMoveOnlyEnumDeinits(Decl *decl) {
   if (auto *ei = dyn_cast<EnumDecl>(decl)) {
-    return usesFeatureMoveOnly(ei) && ei->getValueTypeDestructor();
+    return ei->canBeNoncopyable() && ei->getValueTypeDestructor();
   }
   return false;
 }
 
 static bool usesFeatureMoveOnlyResilientTypes(Decl *decl) {
   if (auto *nomDecl = dyn_cast<NominalTypeDecl>(decl))
-    return nomDecl->isResilient() && usesFeatureMoveOnly(decl);
+    return nomDecl->isResilient() && nomDecl->canBeNoncopyable();
   return false;
 }
 
@@ -3450,17 +3477,22 @@ static bool usesFeatureGenerateBindingsForThrowingFunctionsInCXX(Decl *decl) {
 }
 
 static bool usesFeatureFreestandingExpressionMacros(Decl *decl) {
-  auto macro = dyn_cast<MacroDecl>(decl);
-  if (!macro)
-    return false;
-
-  return macro->getMacroRoles().contains(MacroRole::Expression);
+  return usesMacroRoles(decl, MacroRole::Expression);
 }
 
 static bool usesFeatureLexicalLifetimes(Decl *decl) {
-  return decl->getAttrs().hasAttribute<EagerMoveAttr>()
-         || decl->getAttrs().hasAttribute<NoEagerMoveAttr>()
-         || decl->getAttrs().hasAttribute<LexicalLifetimesAttr>();
+  // A single scan over the attribute list rather than one per kind.
+  for (auto *attr : decl->getAttrs()) {
+    switch (attr->getKind()) {
+    case DAK_EagerMove:
+    case DAK_NoEagerMove:
+    case DAK_LexicalLifetimes:
+      return true;
+    default:
+      break;
+    }
+  }
+  return false;
 }
 
 static void
@@ -3524,13 +3556,19 @@ static bool usesFeatureStructLetDestructuring(Decl *decl) {
 }
 
 static bool usesFeatureNonEscapableTypes(Decl *decl) {
-  if (decl->getAttrs().hasAttribute<NonEscapableAttr>() ||
-      decl->getAttrs().hasAttribute<UnsafeNonEscapableResultAttr>()) {
-    return true;
-  }
-  auto *fd = dyn_cast<FuncDecl>(decl);
-  if (fd && fd->getAttrs().getAttribute(DAK_ResultDependsOnSelf)) {
-    return true;
+  // A single scan over the attribute list rather than one per kind.
+  for (auto *attr : decl->getAttrs()) {
+    switch (attr->getKind()) {
+    case DAK_NonEscapable:
+    case DAK_UnsafeNonEscapableResult:
+      return true;
+    case DAK_ResultDependsOnSelf:
+      if (isa<FuncDecl>(decl))
+        return true;
+      break;
+    default:
+      break;
+    }
   }
   return false;
 }
@@ -3556,7 +3594,7 @@ static bool usesFeatureParameterPacks(Decl *decl) {
     return true;
 
   if (auto *valueDecl = dyn_cast<ValueDecl>(decl)) {
-    if (valueDecl->getInterfaceType().findIf(
+    if (findIfWithoutRevisiting(valueDecl->getInterfaceType(),
         [&](Type t) {
           if (auto *alias = dyn_cast<TypeAliasType>(t.getPointer()))
             return hasParameterPacks(alias->getDecl());
@@ -3633,6 +3671,27 @@ static void suppressingFeature(PrintOptions &options, Feature feature,
   llvm_unreachable("exhaustive switch");
 }
 
+namespace {
+/// An entry in the language-feature check table, tying a feature to the
+/// predicate that determines whether a declaration uses it.
+struct FeatureUsePredicate {
+  Feature feature;
+  bool isSuppressible;
+  bool (*usesFeature)(Decl *);
+};
+} // end anonymous namespace
+
+/// One entry per feature in Features.def, in declaration order.
+static constexpr FeatureUsePredicate featureUsePredicates[] = {
+#define LANGUAGE_FEATURE(FeatureName, SENumber, Description, Option)  \
+  {Feature::FeatureName, /*isSuppressible=*/false,                    \
+   usesFeature##FeatureName},
+#define SUPPRESSIBLE_LANGUAGE_FEATURE(FeatureName, SENumber, Description, Option) \
+  {Feature::FeatureName, /*isSuppressible=*/true,                     \
+   usesFeature##FeatureName},
+#include "swift/Basic/Features.def"
+};
+
 using BasicFeatureSet = FixedBitSet<numFeatures(), Feature>;
 
 class FeatureSet {
@@ -3696,14 +3755,21 @@ public:
   /// either add or remove them to this set.
   void collectFeaturesUsed(Decl *decl, InsertOrRemove operation) {
     // Go through each of the features, checking whether the
-    // declaration uses that feature.
-#define LANGUAGE_FEATURE(FeatureName, SENumber, Description, Option)  \
-    if (usesFeature##FeatureName(decl))                               \
-      collectRequiredFeature(Feature::FeatureName, operation);
-#define SUPPRESSIBLE_LANGUAGE_FEATURE(FeatureName, SENumber, Description, Option)  \
-    if (usesFeature##FeatureName(decl))                               \
-      collectSuppressibleFeature(Feature::FeatureName, operation);
-#include "swift/Basic/Features.def"
+    // declaration uses that feature. When removing features, only
+    // run the check if the feature is still in the set; some of the
+    // usesFeature predicates walk a fair amount of the AST.
+    for (const auto &entry : featureUsePredicates) {
+      if (entry.isSuppressible) {
+        if ((operation == Insert ||
+             suppressible.contains(numFeatures() - size_t(entry.feature))) &&
+            entry.usesFeature(decl))
+          collectSuppressibleFeature(entry.feature, operation);
+      } else {
+        if ((operation == Insert || required.contains(entry.feature)) &&
+            entry.usesFeature(decl))
+          collectRequiredFeature(entry.feature, operation);
+      }
+    }
   }
 };
 
@@ -3714,10 +3780,15 @@ static FeatureSet getUniqueFeaturesUsed(Decl *decl) {
   FeatureSet features;
   features.collectFeaturesUsed(decl, FeatureSet::Insert);
 
-  // Remove all the features used by all enclosing declarations.
+  // If the declaration doesn't use any features, there is nothing for the
+  // enclosing declarations to remove.
+  if (features.empty())
+    return features;
+
+  // Gather the chain of enclosing declarations, innermost first.
+  SmallVector<Decl *, 4> enclosingDecls;
   Decl *enclosingDecl = decl;
-  while (!features.empty()) {
-    // Find the next outermost enclosing declaration.
+  while (true) {
     if (auto accessor = dyn_cast<AccessorDecl>(enclosingDecl))
       enclosingDecl = accessor->getStorage();
     else
@@ -3725,7 +3796,15 @@ static FeatureSet getUniqueFeaturesUsed(Decl *decl) {
     if (!enclosingDecl)
       break;
 
+    enclosingDecls.push_back(enclosingDecl);
+  }
+
+  // Remove all the features used by all enclosing declarations, stopping
+  // as soon as nothing is left to remove.
+  for (Decl *enclosingDecl : enclosingDecls) {
     features.collectFeaturesUsed(enclosingDecl, FeatureSet::Remove);
+    if (features.empty())
+      break;
   }
 
   return features;
@@ -4507,24 +4586,24 @@ void PrintAST::printFunctionParameters(AbstractFunctionDecl *AFD) {
   }
 }
 
+void PrintAST::printDeclWithAuxiliaryDecls(Decl *decl) {
+  if (decl->shouldPrintInContext(Options))
+    visit(decl);
+  decl->visitAuxiliaryDecls(
+      [&](Decl *auxDecl) { printDeclWithAuxiliaryDecls(auxDecl); });
+}
+
 bool PrintAST::printASTNodes(const ArrayRef<ASTNode> &Elements,
                              bool NeedIndent) {
   IndentRAII IndentMore(*this, NeedIndent);
   bool PrintedSomething = false;
 
-  std::function<void(Decl *)> printDecl;
-  printDecl = [&](Decl *d) {
-    if (d->shouldPrintInContext(Options))
-      visit(d);
-    d->visitAuxiliaryDecls(printDecl);
-  };
-
   for (auto element : Elements) {
     PrintedSomething = true;
     Printer.printNewline();
     indent();
     if (auto decl = element.dyn_cast<Decl*>()) {
-      printDecl(decl);
+      printDeclWithAuxiliaryDecls(decl);
     } else if (auto stmt = element.dyn_cast<Stmt*>()) {
       visit(stmt);
     } else {
@@ -23,6 +23,7 @@
 #include "swift/SIL/SILInstruction.h"
 #include "swift/SIL/ScopedAddressUtils.h"
 #include "swift/SIL/Test.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/SmallBitVector.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/Transforms/Utils/ModuleUtils.h"
@@ -32,142 +33,208 @@ using namespace swift;
 static llvm::cl::opt<bool> EmitLogging(
     "sil-move-only-checker-emit-pruned-liveness-logging");
 
+#ifndef NDEBUG
 #define PRUNED_LIVENESS_LOG(X) \
   do { \
-    if (EmitLogging) { \
+    if (LLVM_UNLIKELY(EmitLogging)) { \
       LLVM_DEBUG(X); \
       } \
     } while (0)
-
-// We can only analyze components of structs whose storage is fully accessible
-// from Swift.
-static StructDecl *getFullyReferenceableStruct(SILType ktypeTy) {
-  auto structDecl = ktypeTy.getStructOrBoundGenericStruct();
-  if (!structDecl || structDecl->hasUnreferenceableStorage())
-    return nullptr;
-  return structDecl;
-}
+#else
+#define PRUNED_LIVENESS_LOG(X)
+#endif
 
 //===----------------------------------------------------------------------===//
 //                         MARK: TypeSubElementCount
 //===----------------------------------------------------------------------===//
 
-TypeSubElementCount::TypeSubElementCount(SILType type, SILModule &mod,
-                                         TypeExpansionContext context)
-    : number(1) {
-  if (auto tupleType = type.getAs<TupleType>()) {
-    unsigned numElements = 0;
-    for (auto index : indices(tupleType.getElementTypes()))
-      numElements +=
-          TypeSubElementCount(type.getTupleElementType(index), mod, context);
-    number = numElements;
-    return;
+/// Recursive helper that computes the number of leaf type tree elements of \p
+/// type. Aggregates often contain many fields of the same type, so we memoize
+/// already computed counts in \p cache to avoid rewalking shared sub-trees.
+/// The cache is only valid for a single (module, expansion context) pair, so
+/// it is scoped to one top level query.
+static unsigned
+computeTypeSubElementCount(SILType type, SILModule &mod,
+                           TypeExpansionContext context,
+                           llvm::SmallDenseMap<SILType, unsigned, 8> &cache) {
+  {
+    auto iter = cache.find(type);
+    if (iter != cache.end())
+      return iter->second;
   }
 
-  if (auto *structDecl = getFullyReferenceableStruct(type)) {
-    unsigned numElements = 0;
-    for (auto *fieldDecl : structDecl->getStoredProperties())
-      numElements += TypeSubElementCount(
-          type.getFieldType(fieldDecl, mod, context), mod, context);
-    number = numElements;
+  unsigned number = 1;
 
-    if (type.isValueTypeWithDeinit()) {
-      // 'self' has its own liveness represented as an additional field at the
-      // end of the structure.
-      ++number;
-    }
-    // If we do not have any elements, just set our size to 1.
-    if (number == 0)
-      number = 1;
-
-    return;
-  }
-
-  // If we have an enum, we add one for tracking if the base enum is set and use
-  // the remaining bits for the max sized payload. This ensures that if we have
-  // a smaller sized payload, we still get all of the bits set, allowing for a
-  // homogeneous representation.
-  if (auto *enumDecl = type.getEnumOrBoundGenericEnum()) {
+  if (auto tupleType = type.getAs<TupleType>()) {
     unsigned numElements = 0;
-    for (auto *eltDecl : enumDecl->getAllElements()) {
-      if (!eltDecl->hasAssociatedValues())
-        continue;
-      auto elt = type.getEnumElementType(eltDecl, mod, context);
-      numElements = std::max(numElements,
-                             unsigned(TypeSubElementCount(elt, mod, context)));
+    for (auto index : indices(tupleType.getElementTypes()))
+      numElements += computeTypeSubElementCount(
+          type.getTupleElementType(index), mod, context, cache);
+    number = numElements;
+  } else if (auto *nominalDecl = type.getNominalOrBoundGenericNominal()) {
+    // Fetch the nominal once and classify it, rather than separately probing
+    // the type for a struct and then for an enum. Leaves fall through both
+    // checks with no additional work.
+    if (auto *structDecl = dyn_cast<StructDecl>(nominalDecl)) {
+      // We can only analyze components of structs whose storage is fully
+      // accessible from Swift; otherwise the struct is treated as a leaf.
+      if (!structDecl->hasUnreferenceableStorage()) {
+        unsigned numElements = 0;
+        for (auto *fieldDecl : structDecl->getStoredProperties())
+          numElements += computeTypeSubElementCount(
+              type.getFieldType(fieldDecl, mod, context), mod, context, cache);
+        number = numElements;
+
+        if (type.isValueTypeWithDeinit()) {
+          // 'self' has its own liveness represented as an additional field at
+          // the end of the structure.
+          ++number;
+        }
+        // If we do not have any elements, just set our size to 1.
+        if (number == 0)
+          number = 1;
+      }
+    } else if (auto *enumDecl = dyn_cast<EnumDecl>(nominalDecl)) {
+      // If we have an enum, we add one for tracking if the base enum is set
+      // and use the remaining bits for the max sized payload. This ensures
+      // that if we have a smaller sized payload, we still get all of the bits
+      // set, allowing for a homogeneous representation.
+      unsigned numElements = 0;
+      for (auto *eltDecl : enumDecl->getAllElements()) {
+        if (!eltDecl->hasAssociatedValues())
+          continue;
+        auto elt = type.getEnumElementType(eltDecl, mod, context);
+        numElements = std::max(
+            numElements, computeTypeSubElementCount(elt, mod, context, cache));
+      }
+      number = numElements + 1;
     }
-    number = numElements + 1;
-    return;
   }
 
   // If this isn't a tuple, struct, or enum, it is a single element. This was
-  // our default value, so we can just return.
+  // our default value above.
+  cache[type] = number;
+  return number;
+}
+
+TypeSubElementCount::TypeSubElementCount(SILType type, SILModule &mod,
+                                         TypeExpansionContext context)
+    : number(1) {
+  llvm::SmallDenseMap<SILType, unsigned, 8> cache;
+  number = computeTypeSubElementCount(type, mod, context, cache);
 }
 
 //===----------------------------------------------------------------------===//
 //                           MARK: SubElementNumber
 //===----------------------------------------------------------------------===//
 
+namespace {
+
+/// Helper for SubElementOffset::computeFor{Address,Value} that maps the field
+/// index of an aggregate projection to the sub-element offset at which the
+/// field's leaf elements begin.
+///
+/// Offsets are read out of a per aggregate type prefix sum table that is built
+/// lazily and cached, so a chain of projections that steps through the same
+/// aggregate multiple times only pays for each field's TypeSubElementCount
+/// once. The cache is only valid for a single (module, expansion context)
+/// pair, so it is scoped to one projection walk.
+struct SubElementOffsetTable {
+  SILModule &mod;
+  TypeExpansionContext context;
+  llvm::SmallDenseMap<SILType, SmallVector<unsigned, 8>, 4> prefixSums;
+
+  SubElementOffsetTable(SILModule &mod, TypeExpansionContext context)
+      : mod(mod), context(context) {}
+
+  /// Return the sub-element offset of tuple element \p eltIndex of \p
+  /// tupleType.
+  unsigned getTupleElementOffset(SILType tupleType, unsigned eltIndex) {
+    auto &sums = prefixSums[tupleType];
+    if (sums.empty()) {
+      unsigned total = 0;
+      sums.push_back(total);
+      for (auto index : indices(tupleType.castTo<TupleType>()->getElements())) {
+        total += TypeSubElementCount(tupleType.getTupleElementType(index), mod,
+                                     context);
+        sums.push_back(total);
+      }
+    }
+    return sums[eltIndex];
+  }
+
+  /// Return the sub-element offset of the stored property \p fieldIndex of
+  /// \p structType.
+  unsigned getStructFieldOffset(SILType structType, StructDecl *structDecl,
+                                unsigned fieldIndex) {
+    auto &sums = prefixSums[structType];
+    if (sums.empty()) {
+      unsigned total = 0;
+      sums.push_back(total);
+      for (auto *fieldDecl : structDecl->getStoredProperties()) {
+        total += TypeSubElementCount(
+            structType.getFieldType(fieldDecl, mod, context), mod, context);
+        sums.push_back(total);
+      }
+    }
+    return sums[fieldIndex];
+  }
+};
+
+} // end anonymous namespace
+
 llvm::Optional<SubElementOffset>
 SubElementOffset::computeForAddress(SILValue projectionDerivedFromRoot,
                                     SILValue rootAddress) {
   unsigned finalSubElementOffset = 0;
   SILModule &mod = *rootAddress->getModule();
+  SubElementOffsetTable offsetTable(
+      mod, TypeExpansionContext(*rootAddress->getFunction()));
 
   while (1) {
     // If we got to the root, we're done.
     if (rootAddress == projectionDerivedFromRoot)
       return {SubElementOffset(finalSubElementOffset)};
 
-    if (auto *pbi = dyn_cast<ProjectBoxInst>(projectionDerivedFromRoot)) {
-      projectionDerivedFromRoot = pbi->getOperand();
+    // Dispatch on the value's kind so each hop of the projection walk is a
+    // single table dispatch instead of a cascade of dyn_cast checks.
+    switch (projectionDerivedFromRoot->getKind()) {
+    case ValueKind::ProjectBoxInst:
+      projectionDerivedFromRoot =
+          cast<ProjectBoxInst>(projectionDerivedFromRoot)->getOperand();
       continue;
-    }
 
-    if (auto *bai = dyn_cast<BeginAccessInst>(projectionDerivedFromRoot)) {
-      projectionDerivedFromRoot = bai->getSource();
+    case ValueKind::BeginAccessInst:
+      projectionDerivedFromRoot =
+          cast<BeginAccessInst>(projectionDerivedFromRoot)->getSource();
       continue;
-    }
 
-    if (auto *sbi = dyn_cast<StoreBorrowInst>(projectionDerivedFromRoot)) {
-      projectionDerivedFromRoot = sbi->getDest();
+    case ValueKind::StoreBorrowInst:
+      projectionDerivedFromRoot =
+          cast<StoreBorrowInst>(projectionDerivedFromRoot)->getDest();
       continue;
-    }
 
-    if (auto *m = dyn_cast<MoveOnlyWrapperToCopyableAddrInst>(
-            projectionDerivedFromRoot)) {
-      projectionDerivedFromRoot = m->getOperand();
+    case ValueKind::MoveOnlyWrapperToCopyableAddrInst:
+      projectionDerivedFromRoot =
+          cast<MoveOnlyWrapperToCopyableAddrInst>(projectionDerivedFromRoot)
+              ->getOperand();
       continue;
-    }
-
-    if (auto *teai =
-            dyn_cast<TupleElementAddrInst>(projectionDerivedFromRoot)) {
-      SILType tupleType = teai->getOperand()->getType();
 
+    case ValueKind::TupleElementAddrInst: {
+      auto *teai = cast<TupleElementAddrInst>(projectionDerivedFromRoot);
       // Keep track of what subelement is being referenced.
-      for (unsigned i : range(teai->getFieldIndex())) {
-        finalSubElementOffset += TypeSubElementCount(
-            tupleType.getTupleElementType(i), mod,
-            TypeExpansionContext(*rootAddress->getFunction()));
-      }
+      finalSubElementOffset += offsetTable.getTupleElementOffset(
+          teai->getOperand()->getType(), teai->getFieldIndex());
       projectionDerivedFromRoot = teai->getOperand();
       continue;
     }
 
-    if (auto *seai =
-            dyn_cast<StructElementAddrInst>(projectionDerivedFromRoot)) {
-      SILType type = seai->getOperand()->getType();
-
+    case ValueKind::StructElementAddrInst: {
+      auto *seai = cast<StructElementAddrInst>(projectionDerivedFromRoot);
       // Keep track of what subelement is being referenced.
-      StructDecl *structDecl = seai->getStructDecl();
-      for (auto *fieldDecl : structDecl->getStoredProperties()) {
-        if (fieldDecl == seai->getField())
-          break;
-        auto context = TypeExpansionContext(*rootAddress->getFunction());
-        finalSubElementOffset += TypeSubElementCount(
-            type.getFieldType(fieldDecl, mod, context), mod, context);
-      }
-
+      finalSubElementOffset += offsetTable.getStructFieldOffset(
+          seai->getOperand()->getType(), seai->getStructDecl(),
+          seai->getFieldIndex());
       projectionDerivedFromRoot = seai->getOperand();
       continue;
     }
@@ -182,18 +249,21 @@ SubElementOffset::computeForAddress(SILValue projectionDerivedFromRoot,
     //
     // So our payload is always going to start at the current field number since
     // we are the left most child of our parent enum. So we just need to look
-    // through to our parent enum.
-    if (auto *enumData = dyn_cast<UncheckedTakeEnumDataAddrInst>(
-            projectionDerivedFromRoot)) {
-      projectionDerivedFromRoot = enumData->getOperand();
+    // through to our parent enum. Init enum data addr is treated like unchecked
+    // take enum data addr.
+    case ValueKind::UncheckedTakeEnumDataAddrInst:
+      projectionDerivedFromRoot =
+          cast<UncheckedTakeEnumDataAddrInst>(projectionDerivedFromRoot)
+              ->getOperand();
       continue;
-    }
 
-    // Init enum data addr is treated like unchecked take enum data addr.
-    if (auto *initData =
-            dyn_cast<InitEnumDataAddrInst>(projectionDerivedFromRoot)) {
-      projectionDerivedFromRoot = initData->getOperand();
+    case ValueKind::InitEnumDataAddrInst:
+      projectionDerivedFromRoot =
+          cast<InitEnumDataAddrInst>(projectionDerivedFromRoot)->getOperand();
       continue;
+
+    default:
+      break;
     }
 
     // If we do not know how to handle this case, just return None.
@@ -211,84 +281,63 @@ SubElementOffset::computeForValue(SILValue projectionDerivedFromRoot,
                                   SILValue rootAddress) {
   unsigned finalSubElementOffset = 0;
   SILModule &mod = *rootAddress->getModule();
+  SubElementOffsetTable offsetTable(
+      mod, TypeExpansionContext(*rootAddress->getFunction()));
 
   while (1) {
     // If we got to the root, we're done.
     if (rootAddress == projectionDerivedFromRoot)
       return {SubElementOffset(finalSubElementOffset)};
 
+    // Dispatch on the value's kind so each hop of the projection walk is a
+    // single table dispatch instead of a cascade of dyn_cast checks.
+    switch (projectionDerivedFromRoot->getKind()) {
     // Look through these single operand instructions.
-    if (isa<BeginBorrowInst>(projectionDerivedFromRoot) ||
-        isa<CopyValueInst>(projectionDerivedFromRoot) ||
-        isa<MoveOnlyWrapperToCopyableValueInst>(projectionDerivedFromRoot)) {
+    case ValueKind::BeginBorrowInst:
+    case ValueKind::CopyValueInst:
+    case ValueKind::MoveOnlyWrapperToCopyableValueInst:
       projectionDerivedFromRoot =
           cast<SingleValueInstruction>(projectionDerivedFromRoot)
               ->getOperand(0);
       continue;
-    }
-
-    if (auto *teai = dyn_cast<TupleExtractInst>(projectionDerivedFromRoot)) {
-      SILType tupleType = teai->getOperand()->getType();
 
+    case ValueKind::TupleExtractInst: {
+      auto *teai = cast<TupleExtractInst>(projectionDerivedFromRoot);
       // Keep track of what subelement is being referenced.
-      for (unsigned i : range(teai->getFieldIndex())) {
-        finalSubElementOffset += TypeSubElementCount(
-            tupleType.getTupleElementType(i), mod,
-            TypeExpansionContext(*rootAddress->getFunction()));
-      }
+      finalSubElementOffset += offsetTable.getTupleElementOffset(
+          teai->getOperand()->getType(), teai->getFieldIndex());
       projectionDerivedFromRoot = teai->getOperand();
       continue;
     }
 
-    if (auto *mvir = dyn_cast<MultipleValueInstructionResult>(
-            projectionDerivedFromRoot)) {
+    case ValueKind::MultipleValueInstructionResult: {
+      auto *mvir =
+          cast<MultipleValueInstructionResult>(projectionDerivedFromRoot);
       if (auto *dsi = dyn_cast<DestructureStructInst>(mvir->getParent())) {
-        SILType type = dsi->getOperand()->getType();
-
         // Keep track of what subelement is being referenced.
-        unsigned resultIndex = mvir->getIndex();
-        StructDecl *structDecl = dsi->getStructDecl();
-        for (auto pair : llvm::enumerate(structDecl->getStoredProperties())) {
-          if (pair.index() == resultIndex)
-            break;
-          auto context = TypeExpansionContext(*rootAddress->getFunction());
-          finalSubElementOffset += TypeSubElementCount(
-              type.getFieldType(pair.value(), mod, context), mod, context);
-        }
-
+        finalSubElementOffset += offsetTable.getStructFieldOffset(
+            dsi->getOperand()->getType(), dsi->getStructDecl(),
+            mvir->getIndex());
         projectionDerivedFromRoot = dsi->getOperand();
         continue;
       }
 
       if (auto *dti = dyn_cast<DestructureTupleInst>(mvir->getParent())) {
-        SILType type = dti->getOperand()->getType();
-
         // Keep track of what subelement is being referenced.
-        unsigned resultIndex = mvir->getIndex();
-        for (unsigned i : range(resultIndex)) {
-          auto context = TypeExpansionContext(*rootAddress->getFunction());
-          finalSubElementOffset +=
-              TypeSubElementCount(type.getTupleElementType(i), mod, context);
-        }
-
+        finalSubElementOffset += offsetTable.getTupleElementOffset(
+            dti->getOperand()->getType(), mvir->getIndex());
         projectionDerivedFromRoot = dti->getOperand();
         continue;
       }
+      break;
     }
 
-    if (auto *seai = dyn_cast<StructExtractInst>(projectionDerivedFromRoot)) {
-      SILType type = seai->getOperand()->getType();
-
+    case ValueKind::StructExtractInst: {
+      auto *seai = cast<StructExtractInst>(projectionDerivedFromRoot);
       // Keep track of what subelement is being referenced.
-      StructDecl *structDecl = seai->getStructDecl();
-      for (auto *fieldDecl : structDecl->getStoredProperties()) {
-        if (fieldDecl == seai->getField())
-          break;
-        auto context = TypeExpansionContext(*rootAddress->getFunction());
-        finalSubElementOffset += TypeSubElementCount(
-            type.getFieldType(fieldDecl, mod, context), mod, context);
-      }
-
+      finalSubElementOffset += offsetTable.getStructFieldOffset(
+          seai->getOperand()->getType(), seai->getStructDecl(),
+          seai->getFieldIndex());
       projectionDerivedFromRoot = seai->getOperand();
       continue;
     }
@@ -304,10 +353,13 @@ SubElementOffset::computeForValue(SILValue projectionDerivedFromRoot,
     // So our payload is always going to start at the current field number since
     // we are the left most child of our parent enum. So we just need to look
     // through to our parent enum.
-    if (auto *enumData =
-            dyn_cast<UncheckedEnumDataInst>(projectionDerivedFromRoot)) {
-      projectionDerivedFromRoot = enumData->getOperand();
+    case ValueKind::UncheckedEnumDataInst:
+      projectionDerivedFromRoot =
+          cast<UncheckedEnumDataInst>(projectionDerivedFromRoot)->getOperand();
       continue;
+
+    default:
+      break;
     }
 
     // If we do not know how to handle this case, just return None.
@@ -328,26 +380,48 @@ void TypeTreeLeafTypeRange::constructFilteredProjections(
     SILValue value, SILInstruction *insertPt, SmallBitVector &filterBitVector,
     llvm::function_ref<bool(SILValue, TypeTreeLeafTypeRange)> callback) {
   auto *fn = insertPt->getFunction();
+  SILModule &mod = fn->getModule();
+  auto context = TypeExpansionContext(*fn);
   SILType type = value->getType();
 
   PRUNED_LIVENESS_LOG(llvm::dbgs() << "ConstructFilteredProjection. Bv: "
                           << filterBitVector << '\n');
-  SILBuilderWithScope builder(insertPt);
 
+  // Constructing the builder does scope and debug location work. When the
+  // filter is sparse every field can be skipped without emitting a single
+  // projection, so only construct it on first use.
+  llvm::Optional<SILBuilderWithScope> builder;
+  auto getBuilder = [&]() -> SILBuilderWithScope & {
+    if (!builder)
+      builder.emplace(insertPt);
+    return *builder;
+  };
+
+  // Sub-element counts of sibling fields frequently repeat (several stored
+  // properties or tuple elements of the same type), so share one memo cache
+  // across all of the per-field queries below.
+  llvm::SmallDenseMap<SILType, unsigned, 8> countCache;
+  auto subElementCount = [&](SILType type) {
+    return computeTypeSubElementCount(type, mod, context, countCache);
+  };
+
+  // Both of these scan word-at-a-time via the bitvector's find primitives
+  // rather than testing each bit in [start, end) individually.
   auto noneSet = [](SmallBitVector &bv, unsigned start, unsigned end) {
-    return llvm::none_of(range(start, end),
-                         [&](unsigned index) { return bv[index]; });
+    int firstSet = start == 0 ? bv.find_first() : bv.find_next(start - 1);
+    return firstSet == -1 || unsigned(firstSet) >= end;
   };
   auto allSet = [](SmallBitVector &bv, unsigned start, unsigned end) {
-    return llvm::all_of(range(start, end),
-                        [&](unsigned index) { return bv[index]; });
+    int firstUnset =
+        start == 0 ? bv.find_first_unset() : bv.find_next_unset(start - 1);
+    return firstUnset == -1 || unsigned(firstUnset) >= end;
   };
 
   if (auto *structDecl = type.getStructOrBoundGenericStruct()) {
     unsigned start = startEltOffset;
     for (auto *varDecl : structDecl->getStoredProperties()) {
-      auto nextType = type.getFieldType(varDecl, fn);
-      unsigned next = start + TypeSubElementCount(nextType, fn);
+      auto nextType = type.getFieldType(varDecl, mod, context);
+      unsigned next = start + subElementCount(nextType);
 
       // If we do not have any set bits, do not create the struct element addr
       // for this entry.
@@ -356,8 +430,8 @@ void TypeTreeLeafTypeRange::constructFilteredProjections(
         continue;
       }
 
-      auto newValue =
-          builder.createStructElementAddr(insertPt->getLoc(), value, varDecl);
+      auto newValue = getBuilder().createStructElementAddr(insertPt->getLoc(),
+                                                           value, varDecl);
       callback(newValue, TypeTreeLeafTypeRange(start, next));
       start = next;
     }
@@ -380,9 +454,8 @@ void TypeTreeLeafTypeRange::constructFilteredProjections(
     for (auto *eltDecl : enumDecl->getAllElements()) {
       if (!eltDecl->hasAssociatedValues())
         continue;
-      auto nextType = type.getEnumElementType(eltDecl, fn);
-      maxSubEltCount =
-          std::max(maxSubEltCount, unsigned(TypeSubElementCount(nextType, fn)));
+      auto nextType = type.getEnumElementType(eltDecl, mod, context);
+      maxSubEltCount = std::max(maxSubEltCount, subElementCount(nextType));
     }
 
     // Add a bit for the case bit.
@@ -404,15 +477,15 @@ void TypeTreeLeafTypeRange::constructFilteredProjections(
     unsigned start = startEltOffset;
     for (unsigned index : indices(tupleType.getElementTypes())) {
       auto nextType = type.getTupleElementType(index);
-      unsigned next = start + TypeSubElementCount(nextType, fn);
+      unsigned next = start + subElementCount(nextType);
 
       if (noneSet(filterBitVector, start, next)) {
         start = next;
         continue;
       }
 
-      auto newValue =
-          builder.createTupleElementAddr(insertPt->getLoc(), value, index);
+      auto newValue = getBuilder().createTupleElementAddr(insertPt->getLoc(),
+                                                          value, index);
       callback(newValue, TypeTreeLeafTypeRange(start, next));
       start = next;
     }
@@ -429,11 +502,19 @@ void TypeTreeLeafTypeRange::constructProjectionsForNeededElements(
     SmallVectorImpl<std::pair<SILValue, TypeTreeLeafTypeRange>>
         &resultingProjections) {
   TypeTreeLeafTypeRange rootRange(rootValue);
-  (void)rootRange;
   assert(rootRange.size() == neededElements.size());
 
-  StackList<std::pair<SILValue, TypeTreeLeafTypeRange>> worklist(
-      insertPt->getFunction());
+  // Fast path: if every element of the root is needed, the root value itself
+  // is the single resulting projection. This is the common whole-aggregate
+  // case and needs none of the worklist machinery below.
+  if (neededElements.all()) {
+    resultingProjections.emplace_back(rootValue, rootRange);
+    return;
+  }
+
+  // The worklist is almost always a handful of entries deep, so keep it in
+  // inline storage instead of paying for a stack slab allocation.
+  SmallVector<std::pair<SILValue, TypeTreeLeafTypeRange>, 8> worklist;
   worklist.push_back({rootValue, rootRange});
 
   // Temporary vector we use for our computation.
@@ -483,23 +564,17 @@ void TypeTreeLeafTypeRange::constructProjectionsForNeededElements(
 void TypeTreeLeafTypeRange::visitContiguousRanges(
     SmallBitVector const &bits,
     llvm::function_ref<void(TypeTreeLeafTypeRange)> callback) {
-  if (bits.size() == 0)
-    return;
-
-  llvm::Optional<unsigned> current = llvm::None;
-  for (unsigned bit = 0, size = bits.size(); bit < size; ++bit) {
-    auto isSet = bits.test(bit);
-    if (current) {
-      if (!isSet) {
-        callback(TypeTreeLeafTypeRange(*current, bit));
-        current = llvm::None;
-      }
-    } else if (isSet) {
-      current = bit;
+  // Jump from the start of one run of set bits to the next using the
+  // bitvector's word-at-a-time scan primitives rather than testing each bit
+  // individually.
+  for (int start = bits.find_first(); start != -1;) {
+    int end = bits.find_next_unset(start);
+    if (end == -1) {
+      callback(TypeTreeLeafTypeRange(start, bits.size()));
+      return;
     }
-  }
-  if (current) {
-    callback(TypeTreeLeafTypeRange(*current, bits.size()));
+    callback(TypeTreeLeafTypeRange(start, end));
+    start = bits.find_next(end);
   }
 }
 
@@ -522,12 +597,15 @@ void FieldSensitivePrunedLiveBlocks::computeScalarUseBlockLiveness(
     // Traversal terminates at any previously visited block, including the
     // blocks initialized as definition blocks.
     for (auto *predBlock : block->getPredecessorBlocks()) {
-      switch (getBlockLiveness(predBlock, bitNo)) {
+      // Find (or create) the predecessor's state once and update it in place
+      // rather than performing separate query and mark lookups.
+      auto &predLiveness = getOrCreateBlockLiveness(predBlock);
+      switch (predLiveness.getLiveness(bitNo)) {
       case Dead:
         worklist.pushIfNotVisited(predBlock);
         LLVM_FALLTHROUGH;
       case LiveWithin:
-        markBlockLive(predBlock, bitNo, LiveOut);
+        predLiveness.setLiveness(bitNo, bitNo + 1, LiveOut);
         break;
       case LiveOut:
         break;
@@ -551,30 +629,27 @@ void FieldSensitivePrunedLiveBlocks::updateForUse(
   SWIFT_ASSERT_ONLY(seenUse = true);
 
   auto *bb = user->getParent();
-  getBlockLiveness(bb, startBitNo, endBitNo, resultingLivenessInfo);
-  assert(resultingLivenessInfo.size() == (endBitNo - startBitNo));
 
-  for (unsigned index : indices(resultingLivenessInfo)) {
-    unsigned specificBitNo = startBitNo + index;
-    auto isUseBeforeDef = useBeforeDefBits.test(specificBitNo);
-    switch (resultingLivenessInfo[index]) {
-    case LiveOut:
-    case LiveWithin:
-      if (!isUseBeforeDef) {
-        continue;
-      } else {
-        LLVM_FALLTHROUGH;
-      }
-    case Dead: {
-      // This use block has not yet been marked live. Mark it and its
-      // predecessor blocks live.
-      computeScalarUseBlockLiveness(bb, specificBitNo);
-      resultingLivenessInfo[index] = getBlockLiveness(bb, specificBitNo);
-      continue;
+  // Find the block's packed liveness state once and walk the bits, testing
+  // liveness and use-before-def together in a single pass rather than bulk
+  // unpacking into the result vector and rescanning it.
+  auto liveBlockIter = liveBlocks.find(bb);
+  for (unsigned bitNo = startBitNo; bitNo != endBitNo; ++bitNo) {
+    IsLive isLive = liveBlockIter != liveBlocks.end()
+                        ? liveBlockIter->second.getLiveness(bitNo)
+                        : Dead;
+    if (isLive == Dead || useBeforeDefBits.test(bitNo)) {
+      // This use block has not yet been marked live (or the use is above the
+      // def). Mark it and its predecessor blocks live.
+      computeScalarUseBlockLiveness(bb, bitNo);
+      // Propagation may have inserted blocks into the map, invalidating our
+      // iterator; refetch it.
+      liveBlockIter = liveBlocks.find(bb);
+      isLive = liveBlockIter->second.getLiveness(bitNo);
     }
-    }
-    llvm_unreachable("covered switch");
+    resultingLivenessInfo.push_back(isLive);
   }
+  assert(resultingLivenessInfo.size() == (endBitNo - startBitNo));
 }
 
 llvm::StringRef
@@ -643,60 +718,82 @@ void FieldSensitivePrunedLivenessBoundary::dump() const {
 //                        MARK: FieldSensitiveLiveness
 //===----------------------------------------------------------------------===//
 
-void FieldSensitivePrunedLiveness::updateForUse(
-    SILInstruction *user, TypeTreeLeafTypeRange range, bool lifetimeEnding,
+void FieldSensitivePrunedLiveness::updateBlockLiveness(
+    SILInstruction *user, TypeTreeLeafTypeRange range,
     SmallBitVector const &useBeforeDefBits) {
-  SmallVector<FieldSensitivePrunedLiveBlocks::IsLive, 8> resultingLiveness;
   liveBlocks.updateForUse(user, range.startEltOffset, range.endEltOffset,
-                          useBeforeDefBits, resultingLiveness);
+                          useBeforeDefBits, livenessScratch);
+}
 
+void FieldSensitivePrunedLiveness::updateBlockLiveness(
+    SILInstruction *user, SmallBitVector const &bits,
+    SmallBitVector const &useBeforeDefBits) {
+  // Visit each contiguous run of set bits as one range so that block liveness
+  // is updated once per run instead of once per bit.
+  TypeTreeLeafTypeRange::visitContiguousRanges(
+      bits, [&](TypeTreeLeafTypeRange range) {
+        updateBlockLiveness(user, range, useBeforeDefBits);
+      });
+}
+
+void FieldSensitivePrunedLiveness::updateForUse(
+    SILInstruction *user, TypeTreeLeafTypeRange range, bool lifetimeEnding,
+    SmallBitVector const &useBeforeDefBits) {
+  updateBlockLiveness(user, range, useBeforeDefBits);
   addInterestingUser(user, range, lifetimeEnding);
 }
 
 void FieldSensitivePrunedLiveness::updateForUse(
     SILInstruction *user, SmallBitVector const &bits, bool lifetimeEnding,
     SmallBitVector const &useBeforeDefBits) {
-  for (auto bit : bits.set_bits()) {
-    liveBlocks.updateForUse(user, bit, useBeforeDefBits.test(bit));
-  }
-
+  updateBlockLiveness(user, bits, useBeforeDefBits);
   addInterestingUser(user, bits, lifetimeEnding);
 }
 
 void FieldSensitivePrunedLiveness::extendToNonUse(
     SILInstruction *user, TypeTreeLeafTypeRange range,
     SmallBitVector const &useBeforeDefBits) {
-  SmallVector<FieldSensitivePrunedLiveBlocks::IsLive, 8> resultingLiveness;
-  liveBlocks.updateForUse(user, range.startEltOffset, range.endEltOffset,
-                          useBeforeDefBits, resultingLiveness);
-
+  updateBlockLiveness(user, range, useBeforeDefBits);
   extendToNonUse(user, range);
 }
 
 void FieldSensitivePrunedLiveness::extendToNonUse(
     SILInstruction *user, SmallBitVector const &bits,
     SmallBitVector const &useBeforeDefBits) {
-  for (auto bit : bits.set_bits()) {
-    liveBlocks.updateForUse(user, bit, useBeforeDefBits.test(bit));
-  }
-
+  updateBlockLiveness(user, bits, useBeforeDefBits);
   extendToNonUse(user, bits);
 }
 
+void FieldSensitivePrunedLiveness::getBlockLiveness(
+    SILBasicBlock *bb, SmallBitVector &liveWithinBits,
+    SmallBitVector &liveOutBits, SmallBitVector &deadBits) const {
+  liveWithinBits.resize(getNumSubElements());
+  liveWithinBits.reset();
+  liveOutBits.resize(getNumSubElements());
+  liveOutBits.reset();
+  liveBlocks.getBlockLiveness(bb, liveWithinBits, liveOutBits);
+  deadBits = liveWithinBits;
+  deadBits |= liveOutBits;
+  deadBits.flip();
+}
+
 void FieldSensitivePrunedLiveness::print(llvm::raw_ostream &os) const {
   liveBlocks.print(os);
   for (auto &userAndInterest : users) {
-    for (size_t bit = 0, size = userAndInterest.second.liveBits.size();
-         bit < size; ++bit) {
-      auto isLive = userAndInterest.second.liveBits.test(bit);
-      auto isConsuming = userAndInterest.second.consumingBits.test(bit);
-      if (!isLive && !isConsuming) {
-        continue;
-      } else if (!isLive && isConsuming) {
+    auto &liveBits = userAndInterest.second.liveBits;
+    auto &consumingBits = userAndInterest.second.consumingBits;
+    // Only bits set in at least one of the two vectors produce output, so walk
+    // their union rather than testing every bit individually.
+    SmallBitVector unionBits = liveBits;
+    unionBits |= consumingBits;
+    for (auto bit : unionBits.set_bits()) {
+      auto isLive = liveBits.test(bit);
+      auto isConsuming = consumingBits.test(bit);
+      if (!isLive && isConsuming) {
         os << "non-user: ";
       } else if (isLive && isConsuming) {
         os << "lifetime-ending user: ";
-      } else if (isLive && !isConsuming) {
+      } else {
         os << "regular user: ";
       }
       os << *userAndInterest.first << "\tat " << bit << "\n";
@@ -825,60 +922,59 @@ bool FieldSensitivePrunedLiveRange<LivenessWithDefs>::isWithinBoundary(
       PRUNED_LIVENESS_LOG(llvm::dbgs()
                  << "        LiveOut, but a def block... searching block!\n");
       [[clang::fallthrough]];
-    case FieldSensitivePrunedLiveBlocks::LiveWithin:
-      bool shouldContinue = false;
+    case FieldSensitivePrunedLiveBlocks::LiveWithin: {
       if (!isLive)
         PRUNED_LIVENESS_LOG(llvm::dbgs() << "        LiveWithin... searching block!\n");
 
-      // Now check if the instruction is between a last use and a definition.
-      for (auto &blockInst : llvm::reverse(*block)) {
-        PRUNED_LIVENESS_LOG(llvm::dbgs() << "        Inst: Live: "
-                                << (isLive ? "true" : "false") << "\n"
-                                << "    " << blockInst);
+      // If inst itself is a def, the def ends any previous live range, so
+      // inst is not within the boundary for this bit.
+      if (asImpl().isDef(inst, bit)) {
+        PRUNED_LIVENESS_LOG(llvm::dbgs()
+                   << "        Inst is a def... not within boundary!\n");
+        continue;
+      }
 
-        // First if we see a def, set isLive to false.
-        if (asImpl().isDef(&blockInst, bit)) {
-          PRUNED_LIVENESS_LOG(llvm::dbgs()
-                     << "        Inst is a def... marking live to false!\n");
-          isLive = false;
+      // Otherwise the nearest def or interesting user below inst decides
+      // whether the bit is live at inst, so scan down from inst rather than
+      // walking the entire block in reverse. Only when nothing below inst
+      // mentions the bit does the state at the end of the block decide.
+      bool sawDefBelow = false;
+      for (auto ii = std::next(inst->getIterator()), ie = block->end();
+           ii != ie; ++ii) {
+        PRUNED_LIVENESS_LOG(llvm::dbgs() << "        Inst: " << *ii);
+
+        // An instruction that is both a def and an interesting user keeps the
+        // bit alive up to itself, so check for users first.
+        if (isInterestingUser(&*ii, bit)) {
+          PRUNED_LIVENESS_LOG(
+              llvm::dbgs()
+              << "        Found interesting user below inst... returning "
+                 "true since we are within the boundary for this bit!\n");
+          return true;
         }
 
-        // Then check if we found our instruction in the block...
-        if (&blockInst == inst) {
-          PRUNED_LIVENESS_LOG(llvm::dbgs()
-                     << "        Inst is inst we are looking for.\n");
-
-          // If we are live in the block when we reach the inst... we must be in
-          // the block.
-          if (isLive) {
-            PRUNED_LIVENESS_LOG(llvm::dbgs()
-                       << "        Inst was live... so returning true!\n");
-            return true;
-          }
-
-          // Otherwise, we know that we are not within the boundary for this
-          // def... continue.
-          shouldContinue = true;
+        if (asImpl().isDef(&*ii, bit)) {
           PRUNED_LIVENESS_LOG(llvm::dbgs()
-                     << "        Inst was dead... so breaking out of loop!\n");
+                     << "        Found def below inst... not within "
+                        "boundary for this bit!\n");
+          sawDefBelow = true;
           break;
         }
-
-        // If we are not live and have an interesting user that maps to our bit,
-        // mark this bit as being live again.
-        if (!isLive) {
-          bool isInteresting = isInterestingUser(&blockInst, bit);
-          PRUNED_LIVENESS_LOG(llvm::dbgs()
-                     << "        Inst was dead... Is InterestingUser: "
-                     << (isInteresting ? "true" : "false") << '\n');
-          isLive |= isInteresting;
-        }
       }
-
-      // If we broke out of the inner loop, continue.
-      if (shouldContinue)
+      if (sawDefBelow)
         continue;
-      llvm_unreachable("Inst not in parent block?!");
+
+      // Nothing below inst affects the bit; inst is within the boundary iff
+      // the bit is live at the end of the block.
+      if (isLive) {
+        PRUNED_LIVENESS_LOG(llvm::dbgs()
+                   << "        Live at end of block... returning true!\n");
+        return true;
+      }
+      PRUNED_LIVENESS_LOG(llvm::dbgs()
+                 << "        Dead at end of block... continuing!\n");
+      continue;
+    }
     }
   }
 
@@ -886,17 +982,6 @@ bool FieldSensitivePrunedLiveRange<LivenessWithDefs>::isWithinBoundary(
   return false;
 }
 
-static StringRef getStringRef(FieldSensitivePrunedLiveBlocks::IsLive isLive) {
-  switch (isLive) {
-  case FieldSensitivePrunedLiveBlocks::Dead:
-    return "Dead";
-  case FieldSensitivePrunedLiveBlocks::LiveWithin:
-    return "LiveWithin";
-  case FieldSensitivePrunedLiveBlocks::LiveOut:
-    return "LiveOut";
-  }
-}
-
 template <typename LivenessWithDefs>
 void FieldSensitivePrunedLiveRange<LivenessWithDefs>::computeBoundary(
     FieldSensitivePrunedLivenessBoundary &boundary) const {
@@ -904,49 +989,45 @@ void FieldSensitivePrunedLiveRange<LivenessWithDefs>::computeBoundary(
 
   PRUNED_LIVENESS_LOG(llvm::dbgs() << "Liveness Boundary Compuation!\n");
 
-  using IsLive = FieldSensitivePrunedLiveBlocks::IsLive;
-  SmallVector<IsLive, 8> isLiveTmp;
+  // Scratch vectors reused across blocks. getBlockLiveness sizes and clears
+  // them on each call.
+  SmallBitVector liveWithinBits;
+  SmallBitVector liveOutBits;
+  SmallBitVector deadBits;
+  SmallBitVector succLiveWithinBits;
+  SmallBitVector succLiveOutBits;
+  SmallBitVector succDeadBits;
   for (SILBasicBlock *block : getDiscoveredBlocks()) {
-    SWIFT_DEFER { isLiveTmp.clear(); };
-    getBlockLiveness(block, isLiveTmp);
+    getBlockLiveness(block, liveWithinBits, liveOutBits, deadBits);
 
     PRUNED_LIVENESS_LOG(llvm::dbgs()
                << "Checking for boundary in bb" << block->getDebugID() << '\n');
 
-    // Process each block that has not been visited and is not LiveOut.
-    bool foundAnyNonDead = false;
-    for (auto pair : llvm::enumerate(isLiveTmp)) {
-      unsigned index = pair.index();
-      PRUNED_LIVENESS_LOG(llvm::dbgs() << "Bit: " << index << ". Liveness: "
-                              << getStringRef(pair.value()) << '\n');
-      switch (pair.value()) {
-      case FieldSensitivePrunedLiveBlocks::LiveOut:
-        for (SILBasicBlock *succBB : block->getSuccessors()) {
-          if (getBlockLiveness(succBB, index) ==
-              FieldSensitivePrunedLiveBlocks::Dead) {
-            PRUNED_LIVENESS_LOG(llvm::dbgs() << "Marking succBB as boundary edge: bb"
-                                    << succBB->getDebugID() << '\n');
-            boundary.getBoundaryEdgeBits(succBB).set(index);
-          }
-        }
-        asImpl().findBoundariesInBlock(block, index, /*isLiveOut*/ true,
-                                       boundary);
-        foundAnyNonDead = true;
-        break;
-      case FieldSensitivePrunedLiveBlocks::LiveWithin: {
-        asImpl().findBoundariesInBlock(block, index, /*isLiveOut*/ false,
-                                       boundary);
-        foundAnyNonDead = true;
-        break;
-      }
-      case FieldSensitivePrunedLiveBlocks::Dead:
-        // We do not assert here like in the normal pruned liveness
-        // implementation since we can have dead on some bits and liveness along
-        // others.
-        break;
+    // Boundary edges are successors that are dead along a bit that is live-out
+    // of this block. Rather than walking the successor list once per live-out
+    // bit, intersect each successor's dead mask with our live-out mask in one
+    // word-parallel step.
+    if (liveOutBits.any()) {
+      for (SILBasicBlock *succBB : block->getSuccessors()) {
+        getBlockLiveness(succBB, succLiveWithinBits, succLiveOutBits,
+                         succDeadBits);
+        succDeadBits &= liveOutBits;
+        if (succDeadBits.none())
+          continue;
+        PRUNED_LIVENESS_LOG(llvm::dbgs()
+                            << "Marking succBB as boundary edge: bb"
+                            << succBB->getDebugID() << '\n');
+        boundary.getBoundaryEdgeBits(succBB) |= succDeadBits;
       }
     }
-    assert(foundAnyNonDead && "We should have found atleast one non-dead bit");
+
+    // Only process non-dead bits; a block can be dead along some bits while
+    // live along others. Hand all non-dead bits to the impl at once so it can
+    // find their boundaries in a single pass over the block.
+    SmallBitVector nonDeadBits = deadBits;
+    nonDeadBits.flip();
+    assert(nonDeadBits.any() && "We should have found atleast one non-dead bit");
+    asImpl().findBoundariesInBlock(block, nonDeadBits, liveOutBits, boundary);
   }
 }
 
@@ -964,8 +1045,10 @@ namespace swift::test {
 //   - bool: whether the user is lifetime-ending
 //   - int: the beginning of the range of fields used by the instruction
 //   - int: the end of the range of fields used by the instruction
+// - optionally, the string "nodump" to suppress printing the results, for
+//   callers that only care that liveness was computed
 // Dumps:
-// - the liveness result and boundary
+// - the liveness result and boundary, unless "nodump" was passed
 //
 // Computes liveness for the specified def nodes by considering the
 // specified uses. The actual uses of the def nodes are ignored.
@@ -1016,20 +1099,36 @@ static FunctionTest FieldSensitiveMultiDefUseLiveRangeTest(
             "test specification expects the 'uses:' label\n");
       }
       liveness.finishedInitializationOfDefs();
+      bool emitDump = true;
       while (arguments.hasUntaken()) {
-        auto *inst = arguments.takeInstruction();
+        auto argument = arguments.takeArgument();
+        if (isa<StringArgument>(argument)) {
+          if (cast<StringArgument>(argument).getValue() != "nodump") {
+            llvm::report_fatal_error(
+                "test specification expects the 'nodump' label\n");
+          }
+          emitDump = false;
+          continue;
+        }
+        if (!isa<InstructionArgument>(argument)) {
+          llvm::report_fatal_error(
+              "test specification expects an instruction\n");
+        }
+        auto *inst = cast<InstructionArgument>(argument).getValue();
         auto lifetimeEnding = arguments.takeBool();
         auto begin = arguments.takeUInt();
         auto end = arguments.takeUInt();
         TypeTreeLeafTypeRange range(begin, end);
         liveness.updateForUse(inst, range, lifetimeEnding);
       }
-      liveness.print(llvm::outs());
+      if (emitDump)
+        liveness.print(llvm::outs());
 
       FieldSensitivePrunedLivenessBoundary boundary(
           liveness.getNumSubElements());
       liveness.computeBoundary(boundary);
-      boundary.print(llvm::outs());
+      if (emitDump)
+        boundary.print(llvm::outs());
     });
 } // end namespace swift::test
 
@@ -1057,38 +1156,79 @@ bool FieldSensitiveMultiDefPrunedLiveRange::isUserBeforeDef(
   }
 }
 
+void FieldSensitiveMultiDefPrunedLiveRange::isUserBeforeDef(
+    SILInstruction *user, SmallBitVector const &queryBits,
+    SmallBitVector &useBeforeDefBits) const {
+  auto *block = user->getParent();
+
+  // Only bits defined somewhere within user's block can be use-before-def.
+  SmallBitVector const *blockDefBits = getDefBlockBits(block);
+  if (!blockDefBits)
+    return;
+  SmallBitVector pendingBits = queryBits;
+  pendingBits &= *blockDefBits;
+  if (pendingBits.none())
+    return;
+
+  // An argument def dominates every use in its block.
+  SmallBitVector defBits(getNumSubElements());
+  for (SILArgument *arg : block->getArguments())
+    getDefBits(cast<SILNode>(arg), defBits);
+  pendingBits.reset(defBits);
+
+  // Walk up from user clearing each bit whose def we reach. A bit that
+  // survives to the top of the block is used before its first def. Note that
+  // the walk starts above user: if user is itself a def, its use is still
+  // considered before the def.
+  for (auto *current = user->getPreviousInstruction(); current;
+       current = current->getPreviousInstruction()) {
+    if (pendingBits.none())
+      return;
+    defBits.reset();
+    getDefBits(cast<SILNode>(current), defBits);
+    pendingBits.reset(defBits);
+  }
+  useBeforeDefBits |= pendingBits;
+}
+
 template <typename LivenessWithDefs>
 void FieldSensitivePrunedLiveRange<LivenessWithDefs>::updateForUse(
     SILInstruction *user, TypeTreeLeafTypeRange range, bool lifetimeEnding) {
-  SmallBitVector useBeforeDefBits(getNumSubElements());
-  asImpl().isUserBeforeDef(user, range.getRange(), useBeforeDefBits);
+  useBeforeDefScratch.resize(getNumSubElements());
+  useBeforeDefScratch.reset();
+  asImpl().isUserBeforeDef(user, range.getRange(), useBeforeDefScratch);
   FieldSensitivePrunedLiveness::updateForUse(user, range, lifetimeEnding,
-                                             useBeforeDefBits);
+                                             useBeforeDefScratch);
 }
 
 template <typename LivenessWithDefs>
 void FieldSensitivePrunedLiveRange<LivenessWithDefs>::updateForUse(
     SILInstruction *user, SmallBitVector const &bits, bool lifetimeEnding) {
-  SmallBitVector useBeforeDefBits(getNumSubElements());
-  asImpl().isUserBeforeDef(user, bits.set_bits(), useBeforeDefBits);
+  useBeforeDefScratch.resize(getNumSubElements());
+  useBeforeDefScratch.reset();
+  asImpl().isUserBeforeDef(user, bits, useBeforeDefScratch);
   FieldSensitivePrunedLiveness::updateForUse(user, bits, lifetimeEnding,
-                                             useBeforeDefBits);
+                                             useBeforeDefScratch);
 }
 
 template <typename LivenessWithDefs>
 void FieldSensitivePrunedLiveRange<LivenessWithDefs>::extendToNonUse(
     SILInstruction *user, TypeTreeLeafTypeRange range) {
-  SmallBitVector useBeforeDefBits(getNumSubElements());
-  asImpl().isUserBeforeDef(user, range.getRange(), useBeforeDefBits);
-  FieldSensitivePrunedLiveness::extendToNonUse(user, range, useBeforeDefBits);
+  useBeforeDefScratch.resize(getNumSubElements());
+  useBeforeDefScratch.reset();
+  asImpl().isUserBeforeDef(user, range.getRange(), useBeforeDefScratch);
+  FieldSensitivePrunedLiveness::extendToNonUse(user, range,
+                                               useBeforeDefScratch);
 }
 
 template <typename LivenessWithDefs>
 void FieldSensitivePrunedLiveRange<LivenessWithDefs>::extendToNonUse(
     SILInstruction *user, SmallBitVector const &bits) {
-  SmallBitVector useBeforeDefBits(getNumSubElements());
-  asImpl().isUserBeforeDef(user, bits.set_bits(), useBeforeDefBits);
-  FieldSensitivePrunedLiveness::extendToNonUse(user, bits, useBeforeDefBits);
+  useBeforeDefScratch.resize(getNumSubElements());
+  useBeforeDefScratch.reset();
+  asImpl().isUserBeforeDef(user, bits, useBeforeDefScratch);
+  FieldSensitivePrunedLiveness::extendToNonUse(user, bits,
+                                               useBeforeDefScratch);
 }
 
 //===----------------------------------------------------------------------===//
@@ -1178,6 +1318,20 @@ void FieldSensitiveSSAPrunedLiveRange::findBoundariesInBlock(
   findBoundaryInSSADefBlock(defNode, bitNo, boundary, *this);
 }
 
+void FieldSensitiveSSAPrunedLiveRange::findBoundariesInBlock(
+    SILBasicBlock *block, SmallBitVector const &activeBits,
+    SmallBitVector const &liveOutBits,
+    FieldSensitivePrunedLivenessBoundary &boundary) const {
+  assert(isInitialized());
+
+  // For SSA, a live-out block cannot have a boundary, so only the live-within
+  // bits need a search.
+  SmallBitVector liveWithinBits = activeBits;
+  liveWithinBits.reset(liveOutBits);
+  for (auto bitNo : liveWithinBits.set_bits())
+    findBoundariesInBlock(block, bitNo, /*isLiveOut*/ false, boundary);
+}
+
 //===----------------------------------------------------------------------===//
 //                MARK: FieldSensitiveMultiDefPrunedLiveRange
 //===----------------------------------------------------------------------===//
@@ -1188,141 +1342,127 @@ template class FieldSensitivePrunedLiveRange<
 } // namespace swift
 
 void FieldSensitiveMultiDefPrunedLiveRange::findBoundariesInBlock(
-    SILBasicBlock *block, unsigned bitNo, bool isLiveOut,
+    SILBasicBlock *block, SmallBitVector const &activeBits,
+    SmallBitVector const &liveOutBits,
     FieldSensitivePrunedLivenessBoundary &boundary) const {
   assert(isInitialized());
 
   PRUNED_LIVENESS_LOG(llvm::dbgs() << "Checking for boundary in bb"
-                          << block->getDebugID() << " for bit: " << bitNo
-                          << ". Is Live: " << (isLiveOut ? "true" : "false")
-                          << '\n');
-
-  if (!isDefBlock(block, bitNo)) {
-    PRUNED_LIVENESS_LOG(llvm::dbgs() << "    Not a def block for this bit?!\n");
-    // A live-out block that does not contain any defs cannot have a boundary.
-    if (isLiveOut) {
-      PRUNED_LIVENESS_LOG(llvm::dbgs() << "    Is live out... nothing further to do.\n");
-      return;
-    }
+                          << block->getDebugID() << '\n');
 
-    PRUNED_LIVENESS_LOG(llvm::dbgs() << "    Is LiveWithin, so looking for boundary "
-                               "in non-def block?!\n");
-    findBoundaryInNonDefBlock(block, bitNo, boundary, *this);
-    return;
-  }
-
-  PRUNED_LIVENESS_LOG(llvm::dbgs() << "Is def block!\n");
-
-  // Handle def blocks...
-  //
-  // First, check for an SSA live range
-  if (defs.size() == 1) {
-    PRUNED_LIVENESS_LOG(llvm::dbgs() << "Has single def...\n");
-    // For SSA, a live-out block cannot have a boundary.
-    if (isLiveOut) {
-      PRUNED_LIVENESS_LOG(llvm::dbgs() << "Is live out... no further work to do...\n");
-      return;
-    }
-
-    PRUNED_LIVENESS_LOG(llvm::dbgs() << "Is live within... checking for boundary "
-                               "using SSA def block impl.\n");
-    assert(defs.vector_begin()->second->contains(bitNo));
-    findBoundaryInSSADefBlock(defs.vector_begin()->first, bitNo, boundary,
-                              *this);
-    return;
-  }
-
-  PRUNED_LIVENESS_LOG(llvm::dbgs() << "Has multiple defs!\n");
-
-  // Handle a live-out or live-within block with potentially multiple defs
 #ifndef NDEBUG
-  // We only use prevCount when checking a specific invariant when asserts are
+  // We only use prevCounts when checking a specific invariant when asserts are
   // enabled. boundary.getNumLastUsersAndDeadDefs actually asserts if you try to
   // call it in a non-asserts compiler since it is relatively inefficient and
   // not needed.
-  unsigned prevCount = boundary.getNumLastUsersAndDeadDefs(bitNo);
+  SmallVector<unsigned, 8> prevCounts;
+  for (auto bitNo : activeBits.set_bits()) {
+    prevCounts.push_back(liveOutBits.test(bitNo)
+                             ? 0
+                             : boundary.getNumLastUsersAndDeadDefs(bitNo));
+  }
 #endif
-  bool isLive = isLiveOut;
+
+  // A single reverse sweep over the block maintains, for every active bit,
+  // whether we are currently within that bit's live range. Each instruction's
+  // def and interesting-user masks are fetched with one lookup apiece and all
+  // per-bit state updates are whole-mask bitvector operations.
+  SmallBitVector const *blockDefBits = getDefBlockBits(block);
+  const bool hasDefs = blockDefBits && blockDefBits->anyCommon(activeBits);
+  SmallBitVector isLiveBits = liveOutBits;
+  SmallBitVector defBits(getNumSubElements());
+  SmallBitVector interestingBits(getNumSubElements());
+  SmallBitVector scratchBits(getNumSubElements());
   for (auto &inst : llvm::reverse(*block)) {
     PRUNED_LIVENESS_LOG(llvm::dbgs() << "Visiting: " << inst);
-    PRUNED_LIVENESS_LOG(llvm::dbgs() << "    Initial IsLive: "
-                            << (isLive ? "true" : "false") << '\n');
-
-    // Check if the instruction is a def before checking whether it is a
-    // use. The same instruction can be both a dead def and boundary use.
-    if (isDef(&inst, bitNo)) {
-      PRUNED_LIVENESS_LOG(llvm::dbgs() << "    Is a def inst!\n");
-      if (!isLive) {
-        PRUNED_LIVENESS_LOG(llvm::dbgs() << "        We are not live... so mark as dead "
-                                   "def and keep isLive false!\n");
-        boundary.getDeadDefsBits(cast<SILNode>(&inst)).set(bitNo);
-      } else {
-        PRUNED_LIVENESS_LOG(
-            llvm::dbgs()
-            << "        Is live usage... so just mark isLive to false.\n");
+
+    // Check for defs before checking for uses. The same instruction can be
+    // both a dead def and boundary use.
+    if (hasDefs) {
+      defBits.reset();
+      getDefBits(cast<SILNode>(&inst), defBits);
+      defBits &= activeBits;
+      if (defBits.any()) {
+        // Bits that are defined here without being live are dead defs; either
+        // way the def ends liveness above it.
+        scratchBits = defBits;
+        scratchBits.reset(isLiveBits);
+        if (scratchBits.any()) {
+          PRUNED_LIVENESS_LOG(llvm::dbgs() << "    Is a dead def!\n");
+          boundary.getDeadDefsBits(cast<SILNode>(&inst)) |= scratchBits;
+        }
+        isLiveBits.reset(defBits);
       }
-      isLive = false;
     }
 
     // Note: the same instruction could potentially be both a dead def and last
     // user. The liveness boundary supports this, although it won't happen in
     // any context where we care about inserting code on the boundary.
-    PRUNED_LIVENESS_LOG(llvm::dbgs()
-               << "    Checking if this inst is also a last user...\n");
-    if (!isLive) {
-      if (isInterestingUser(&inst, bitNo)) {
-        PRUNED_LIVENESS_LOG(
-            llvm::dbgs()
-            << "        Was interesting user! Moving from dead -> live!\n");
-        boundary.getLastUserBits(&inst).set(bitNo);
-        isLive = true;
-      } else {
-        PRUNED_LIVENESS_LOG(llvm::dbgs()
-                   << "        Not interesting user... keeping dead!\n");
-      }
-    } else {
-      PRUNED_LIVENESS_LOG(llvm::dbgs()
-                 << "        Was live already, so cannot be a last user!\n");
+    interestingBits.reset();
+    getInterestingUserBits(&inst, interestingBits);
+    interestingBits &= activeBits;
+    interestingBits.reset(isLiveBits);
+    if (interestingBits.any()) {
+      PRUNED_LIVENESS_LOG(llvm::dbgs() << "    Is a last user!\n");
+      boundary.getLastUserBits(&inst) |= interestingBits;
+      isLiveBits |= interestingBits;
     }
   }
 
   PRUNED_LIVENESS_LOG(llvm::dbgs() << "Finished processing block instructions... now "
                              "checking for dead arguments if dead!\n");
-  if (!isLive) {
-    PRUNED_LIVENESS_LOG(llvm::dbgs() << "    Not live! Checking for dead args!\n");
-    for (SILArgument *deadArg : block->getArguments()) {
-      auto iter = defs.find(deadArg);
-      if (iter.has_value() &&
-          llvm::any_of(*iter, [&](TypeTreeLeafTypeRange span) {
-            return span.contains(bitNo);
-          })) {
-        PRUNED_LIVENESS_LOG(llvm::dbgs() << "    Found dead arg: " << *deadArg);
-        boundary.getDeadDefsBits(deadArg).set(bitNo);
+  // Bits that are not live at the top of the block may be defined by a dead
+  // argument.
+  scratchBits = activeBits;
+  scratchBits.reset(isLiveBits);
+  if (hasDefs && scratchBits.any()) {
+    for (SILArgument *arg : block->getArguments()) {
+      defBits.reset();
+      getDefBits(cast<SILNode>(arg), defBits);
+      defBits &= scratchBits;
+      if (defBits.any()) {
+        PRUNED_LIVENESS_LOG(llvm::dbgs() << "    Found dead arg: " << *arg);
+        boundary.getDeadDefsBits(arg) |= defBits;
       }
     }
 
-    // If all of our single predecessors are LiveOut and we are not live, then
-    // we need to mark ourselves as a boundary block so we clean up the live out
-    // value.
+    // If all of our predecessors are LiveOut along a def block's bit that we
+    // are not live at, then we need to mark ourselves as a boundary block so
+    // we clean up the live out value.
     //
     // TODO: What if we have a mix/match of LiveWithin and LiveOut.
-    if (!block->pred_empty()) {
-      if (llvm::all_of(block->getPredecessorBlocks(),
-                       [&](SILBasicBlock *predBlock) -> bool {
-                         return getBlockLiveness(predBlock, bitNo) ==
-                                FieldSensitivePrunedLiveBlocks::IsLive::LiveOut;
-                       })) {
-        boundary.getBoundaryEdgeBits(block).set(bitNo);
+    if (defs.size() > 1 && !block->pred_empty()) {
+      defBits = *blockDefBits;
+      defBits &= scratchBits;
+      if (defBits.any()) {
+        // Intersect the predecessors' live-out masks once rather than
+        // querying every predecessor for each bit.
+        SmallBitVector predLiveWithinBits;
+        SmallBitVector predLiveOutBits;
+        SmallBitVector predDeadBits;
+        for (auto *predBlock : block->getPredecessorBlocks()) {
+          getBlockLiveness(predBlock, predLiveWithinBits, predLiveOutBits,
+                           predDeadBits);
+          defBits &= predLiveOutBits;
+          if (defBits.none())
+            break;
+        }
+        if (defBits.any())
+          boundary.getBoundaryEdgeBits(block) |= defBits;
       }
     }
-  } else {
-    PRUNED_LIVENESS_LOG(llvm::dbgs()
-               << "    Live at beginning of block! No dead args!\n");
   }
 
-  assert(
-      (isLiveOut || prevCount < boundary.getNumLastUsersAndDeadDefs(bitNo)) &&
-      "findBoundariesInBlock must be called on a live block");
+#ifndef NDEBUG
+  unsigned prevCountIndex = 0;
+  for (auto bitNo : activeBits.set_bits()) {
+    assert((liveOutBits.test(bitNo) ||
+            prevCounts[prevCountIndex] <
+                boundary.getNumLastUsersAndDeadDefs(bitNo)) &&
+           "findBoundariesInBlock must be called on a live block");
+    ++prevCountIndex;
+  }
+#endif
 }
 
 bool FieldSensitiveMultiDefPrunedLiveRange::findEarlierConsumingUse(
@@ -1333,57 +1473,16 @@ bool FieldSensitiveMultiDefPrunedLiveRange::findEarlierConsumingUse(
       << "Performing single block search for consuming use for bit: " << index
       << "!\n");
 
-  // Walk our block back from inst looking for defs or a consuming use. If we
-  // see a def, return true. If we see a use, we keep processing if the callback
-  // returns true... and return false early if the callback returns false.
-  for (auto ii = std::next(inst->getReverseIterator()),
-            ie = inst->getParent()->rend();
-       ii != ie; ++ii) {
-    PRUNED_LIVENESS_LOG(llvm::dbgs() << "Visiting: " << *ii);
-    // If we have a def, then we are automatically done.
-    if (isDef(&*ii, index)) {
-      PRUNED_LIVENESS_LOG(llvm::dbgs() << "    Is Def! Returning true!\n");
-      return true;
-    }
-
-    // If we have a consuming use, emit the error.
-    if (isInterestingUser(&*ii, index) ==
-        IsInterestingUser::LifetimeEndingUse) {
-      PRUNED_LIVENESS_LOG(llvm::dbgs() << "    Is Lifetime Ending Use!\n");
-      if (!callback(&*ii)) {
-        PRUNED_LIVENESS_LOG(llvm::dbgs()
-                            << "    Callback returned false... exiting!\n");
-        return false;
-      }
-      PRUNED_LIVENESS_LOG(llvm::dbgs()
-                          << "    Callback returned true... continuing!\n");
-    }
-
-    // Otherwise, keep going.
-  }
-
-  // Then check our argument defs.
-  for (auto *arg : inst->getParent()->getArguments()) {
-    PRUNED_LIVENESS_LOG(llvm::dbgs() << "Visiting arg: " << *arg);
-    if (isDef(arg, index)) {
-      PRUNED_LIVENESS_LOG(llvm::dbgs() << "    Found def. Returning true!\n");
-      return true;
-    }
-  }
-
-  PRUNED_LIVENESS_LOG(llvm::dbgs() << "Finished single block. Didn't find "
-                                      "anything... Performing interprocedural");
-
-  // Ok, we now know that we need to look further back.
-  BasicBlockWorklist worklist(inst->getFunction());
-  for (auto *predBlock : inst->getParent()->getPredecessorBlocks()) {
-    worklist.pushIfNotVisited(predBlock);
-  }
-
-  while (auto *next = worklist.pop()) {
-    PRUNED_LIVENESS_LOG(llvm::dbgs()
-                        << "Checking block bb" << next->getDebugID() << '\n');
-    for (auto ii = next->rbegin(), ie = next->rend(); ii != ie; ++ii) {
+  // Walk \p block back from above \p startAfter (or from the terminator when
+  // \p startAfter is null) looking for defs or consuming uses, then check the
+  // block's argument defs. Returns true if we found a def, false if the
+  // callback told us to stop early on a consuming use, and None if the search
+  // should continue into predecessors.
+  auto scanBlock = [&](SILBasicBlock *block, SILInstruction *startAfter)
+      -> llvm::Optional<bool> {
+    auto ii = startAfter ? std::next(startAfter->getReverseIterator())
+                         : block->rbegin();
+    for (auto ie = block->rend(); ii != ie; ++ii) {
       PRUNED_LIVENESS_LOG(llvm::dbgs() << "Visiting: " << *ii);
       // If we have a def, then we are automatically done.
       if (isDef(&*ii, index)) {
@@ -1407,7 +1506,8 @@ bool FieldSensitiveMultiDefPrunedLiveRange::findEarlierConsumingUse(
       // Otherwise, keep going.
     }
 
-    for (auto *arg : next->getArguments()) {
+    // Then check our argument defs.
+    for (auto *arg : block->getArguments()) {
       PRUNED_LIVENESS_LOG(llvm::dbgs() << "Visiting arg: " << *arg);
       if (isDef(arg, index)) {
         PRUNED_LIVENESS_LOG(llvm::dbgs() << "    Found def. Returning true!\n");
@@ -1415,6 +1515,44 @@ bool FieldSensitiveMultiDefPrunedLiveRange::findEarlierConsumingUse(
       }
     }
 
+    return llvm::None;
+  };
+
+  // Return true if \p block could contain a def or a lifetime ending user of
+  // our bit. Blocks that cannot are skipped without scanning their
+  // instructions.
+  auto mayContainHit = [&](SILBasicBlock *block) -> bool {
+    if (auto *defBits = getDefBlockBits(block))
+      if (defBits->test(index))
+        return true;
+    if (auto *consumingBits = getConsumingBlockBits(block))
+      if (consumingBits->test(index))
+        return true;
+    return false;
+  };
+
+  if (mayContainHit(inst->getParent())) {
+    if (auto result = scanBlock(inst->getParent(), inst))
+      return *result;
+  }
+
+  PRUNED_LIVENESS_LOG(llvm::dbgs() << "Finished single block. Didn't find "
+                                      "anything... Performing interprocedural");
+
+  // Ok, we now know that we need to look further back.
+  BasicBlockWorklist worklist(inst->getFunction());
+  for (auto *predBlock : inst->getParent()->getPredecessorBlocks()) {
+    worklist.pushIfNotVisited(predBlock);
+  }
+
+  while (auto *next = worklist.pop()) {
+    PRUNED_LIVENESS_LOG(llvm::dbgs()
+                        << "Checking block bb" << next->getDebugID() << '\n');
+    if (mayContainHit(next)) {
+      if (auto result = scanBlock(next, nullptr))
+        return *result;
+    }
+
     PRUNED_LIVENESS_LOG(llvm::dbgs()
                         << "Didn't find anything... visiting predecessors!\n");
     for (auto *predBlock : next->getPredecessorBlocks()) {